@@ -3,53 +3,636 @@
 //
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
 #include <mutex>
 #include <numeric>
+#include <random>
+#include <stdexcept>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
+#ifdef BENCHMARK
 constexpr bool benchmark{true};
+#else
+constexpr bool benchmark{false};
+#endif
 
 std::vector<std::pair<std::thread::id, std::size_t>> records;
 std::mutex records_mutex;
 std::size_t threshold{10'000'000};
 
+/// the original version, which spawns a thread at every split, as the baseline
 template <typename Iterator, typename T>
-T p_accumulate(Iterator first, Iterator last, T init) {
+T spawning_p_accumulate(Iterator first, Iterator last, T init) {
   auto distance{std::distance(first, last)};
-  if (distance <= threshold) {
+  if (static_cast<std::size_t>(distance) <= threshold)
+    return std::accumulate(first, last, init);
+  auto mid{first + distance / 2};
+  T sum1{init};
+  std::thread thread{[&] { sum1 += spawning_p_accumulate(first, mid, init); }};
+  T sum2{spawning_p_accumulate(mid, last, init) - init};
+  thread.join();
+  return sum1 + sum2;
+}
+
+/// fork-join pool: every worker pushes the tasks it spawns to the front of its
+/// own deque and pops them from there, while idle workers steal from the back
+/// of the others' deques, so thieves take the oldest and therefore largest
+/// tasks. Threads outside the pool spawn into a shared deque. A thread that
+/// waits for a task to be done runs pending tasks meanwhile, and idle workers
+/// sleep on an atomic counter of spawned tasks after a few rounds of spinning
+class thread_pool {
+  using task = std::function<void()>;
+
+  class work_stealing_queue {
+    std::mutex mutex;
+    std::deque<task> tasks;
+
+   public:
+    void push(task t) {
+      std::scoped_lock lock{mutex};
+      tasks.push_front(std::move(t));
+    }
+    bool try_pop(task &t) {
+      std::scoped_lock lock{mutex};
+      if (tasks.empty()) return false;
+      t = std::move(tasks.front());
+      tasks.pop_front();
+      return true;
+    }
+    bool try_steal(task &t) {
+      std::scoped_lock lock{mutex};
+      if (tasks.empty()) return false;
+      t = std::move(tasks.back());
+      tasks.pop_back();
+      return true;
+    }
+  };
+
+  static constexpr int n_spins{64};
+  std::atomic<bool> done{false};
+  std::atomic<int> n_sleepers{0};
+  std::atomic<std::uint32_t> n_spawned{0};
+  work_stealing_queue shared_queue;
+  std::vector<std::unique_ptr<work_stealing_queue>> queues;
+  std::vector<std::thread> threads;
+
+  inline static thread_local thread_pool *local_pool{nullptr};
+  inline static thread_local std::size_t local_index{0};
+
+  bool try_run_pending_task() {
+    task t;
+    bool is_worker{local_pool == this};
+    bool found{is_worker && queues[local_index]->try_pop(t)};
+    if (!found) found = shared_queue.try_steal(t);
+    for (std::size_t i{1}; !found && i <= queues.size(); ++i)
+      found = queues[(local_index + i) % queues.size()]->try_steal(t);
+    if (found) t();
+    return found;
+  }
+
+  void work(std::size_t index) {
+    local_pool = this;
+    local_index = index;
+    for (int i{0}; !done.load();) {
+      if (try_run_pending_task()) {
+        i = 0;
+        continue;
+      }
+      if (++i < n_spins) {
+        std::this_thread::yield();
+        continue;
+      }
+      ++n_sleepers;
+      std::uint32_t observed_spawns{n_spawned.load()};
+      // a spawn that missed the sleeper has already published its task
+      if (!try_run_pending_task() && !done.load())
+        n_spawned.wait(observed_spawns);
+      --n_sleepers;
+      i = 0;
+    }
+  }
+
+ public:
+  /// n_threads counts the thread waiting on the pool, which runs tasks too
+  explicit thread_pool(unsigned n_threads = std::thread::hardware_concurrency())
+      : queues(std::max(1U, n_threads) - 1) {
+    for (auto &queue : queues) queue = std::make_unique<work_stealing_queue>();
+    for (std::size_t i{0}; i < queues.size(); ++i)
+      threads.emplace_back(&thread_pool::work, this, i);
+  }
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+  ~thread_pool() {
+    done.store(true);
+    ++n_spawned;
+    n_spawned.notify_all();
+    for (auto &thread : threads) thread.join();
+  }
+
+  std::size_t size() const { return queues.size() + 1; }
+
+  template <typename F>
+  void spawn(F f) {
+    if (local_pool == this)
+      queues[local_index]->push(std::move(f));
+    else
+      shared_queue.push(std::move(f));
+    ++n_spawned;
+    if (n_sleepers.load() > 0) n_spawned.notify_one();
+  }
+
+  /// runs pending tasks until is_done holds
+  template <typename IsDone>
+  void wait_until(IsDone is_done) {
+    while (!is_done())
+      if (!try_run_pending_task()) std::this_thread::yield();
+  }
+};
+
+/// splits into tasks_per_thread chunks per thread for the thieves to balance,
+/// but not into chunks so small that spawning them costs more than summing
+std::size_t chunk_size_for(std::size_t distance, std::size_t n_threads) {
+  constexpr std::size_t tasks_per_thread{8};
+  constexpr std::size_t min_chunk_size{1 << 16};
+  return std::max(min_chunk_size,
+                  (distance + n_threads * tasks_per_thread - 1) /
+                      (n_threads * tasks_per_thread));
+}
+
+/// how the leaves add up contiguous arithmetic elements. in_order keeps the
+/// left fold of std::accumulate, except for integers, whose sums do not
+/// depend on the order; the others let the leaves add floating-point
+/// elements in independent SIMD lanes: plainly, with Kahan compensation per
+/// lane, or pairwise down to small blocks
+enum class summation { in_order, reassociate, kahan, pairwise };
+
+enum class instruction_set { scalar, sse2, avx2 };
+
+instruction_set best_instruction_set() {
+#if defined(__x86_64__) && defined(__GNUC__)
+  static const instruction_set best{__builtin_cpu_supports("avx2")
+                                        ? instruction_set::avx2
+                                        : instruction_set::sse2};
+  return best;
+#else
+  return instruction_set::scalar;
+#endif
+}
+
+constexpr std::size_t n_accumulators{4};
+
+/// n_accumulators independent sums of V, a vector of lanes or T itself, so
+/// that consecutive additions do not wait on each other
+template <typename T, typename V>
+[[gnu::always_inline]] inline T sum_lanes(const T *p, std::size_t n) {
+  constexpr std::size_t n_lanes{sizeof(V) / sizeof(T)};
+  constexpr std::size_t step{n_lanes * n_accumulators};
+  V sums[n_accumulators]{};
+  std::size_t i{0};
+  for (; i + step <= n; i += step)
+    // unrolled, or the accumulators would live on the stack
+#pragma GCC unroll 4
+    for (std::size_t k{0}; k < n_accumulators; ++k) {
+      V v;
+      std::memcpy(&v, p + i + k * n_lanes, sizeof(V));
+      sums[k] += v;
+    }
+  T sum{};
+  for (auto &lanes : sums)
+    if constexpr (n_lanes == 1)
+      sum += lanes;
+    else
+      for (std::size_t lane{0}; lane < n_lanes; ++lane) sum += lanes[lane];
+  for (; i < n; ++i) sum += p[i];
+  return sum;
+}
+
+template <typename T, typename V>
+[[gnu::always_inline]] inline T kahan_sum_lanes(const T *p, std::size_t n) {
+  constexpr std::size_t n_lanes{sizeof(V) / sizeof(T)};
+  constexpr std::size_t step{n_lanes * n_accumulators};
+  V sums[n_accumulators]{};
+  V compensations[n_accumulators]{};
+  auto add = [](T &sum, T &compensation, T value) {
+    T y{value - compensation};
+    T t{sum + y};
+    compensation = (t - sum) - y;
+    sum = t;
+  };
+  std::size_t i{0};
+  for (; i + step <= n; i += step)
+    // unrolled, or the accumulators would live on the stack
+#pragma GCC unroll 4
+    for (std::size_t k{0}; k < n_accumulators; ++k) {
+      V v;
+      std::memcpy(&v, p + i + k * n_lanes, sizeof(V));
+      V y{v - compensations[k]};
+      V t{sums[k] + y};
+      compensations[k] = (t - sums[k]) - y;
+      sums[k] = t;
+    }
+  T sum{};
+  T compensation{};
+  for (std::size_t k{0}; k < n_accumulators; ++k)
+    if constexpr (n_lanes == 1) {
+      add(sum, compensation, sums[k]);
+      add(sum, compensation, -compensations[k]);
+    } else {
+      for (std::size_t lane{0}; lane < n_lanes; ++lane) {
+        add(sum, compensation, sums[k][lane]);
+        add(sum, compensation, -compensations[k][lane]);
+      }
+    }
+  for (; i < n; ++i) add(sum, compensation, p[i]);
+  return sum;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+template <typename T>
+using vector128 [[gnu::vector_size(16)]] = T;
+template <typename T>
+using vector256 [[gnu::vector_size(32)]] = T;
+
+template <typename T>
+[[gnu::target("sse2")]] T sum_sse2(const T *p, std::size_t n) {
+  return sum_lanes<T, vector128<T>>(p, n);
+}
+template <typename T>
+[[gnu::target("avx2")]] T sum_avx2(const T *p, std::size_t n) {
+  return sum_lanes<T, vector256<T>>(p, n);
+}
+template <typename T>
+[[gnu::target("sse2")]] T kahan_sum_sse2(const T *p, std::size_t n) {
+  return kahan_sum_lanes<T, vector128<T>>(p, n);
+}
+template <typename T>
+[[gnu::target("avx2")]] T kahan_sum_avx2(const T *p, std::size_t n) {
+  return kahan_sum_lanes<T, vector256<T>>(p, n);
+}
+#endif
+
+template <typename T>
+T reassociated_sum(const T *p, std::size_t n, instruction_set isa) {
+#if defined(__x86_64__) && defined(__GNUC__)
+  if (isa == instruction_set::avx2) return sum_avx2(p, n);
+  if (isa == instruction_set::sse2) return sum_sse2(p, n);
+#endif
+  return sum_lanes<T, T>(p, n);
+}
+
+template <typename T>
+T kahan_sum(const T *p, std::size_t n, instruction_set isa) {
+#if defined(__x86_64__) && defined(__GNUC__)
+  if (isa == instruction_set::avx2) return kahan_sum_avx2(p, n);
+  if (isa == instruction_set::sse2) return kahan_sum_sse2(p, n);
+#endif
+  return kahan_sum_lanes<T, T>(p, n);
+}
+
+/// halves down to blocks small enough for the lanes' own rounding errors not
+/// to matter, so the error grows with log n rather than n
+template <typename T>
+T pairwise_sum(const T *p, std::size_t n, instruction_set isa) {
+  constexpr std::size_t block_size{256};
+  if (n <= block_size) return reassociated_sum(p, n, isa);
+  return pairwise_sum(p, n / 2, isa) + pairwise_sum(p + n / 2, n - n / 2, isa);
+}
+
+template <typename T>
+T simd_sum(const T *p, std::size_t n, summation mode, instruction_set isa) {
+  if constexpr (std::is_floating_point_v<T>) {
+    if (mode == summation::kahan) return kahan_sum(p, n, isa);
+    if (mode == summation::pairwise) return pairwise_sum(p, n, isa);
+    return reassociated_sum(p, n, isa);
+  } else {
+    // lanes wrap around where a signed sum might overflow in between
+    using U = std::make_unsigned_t<T>;
+    return static_cast<T>(
+        reassociated_sum(reinterpret_cast<const U *>(p), n, isa));
+  }
+}
+
+template <typename Iterator, typename T>
+T accumulate_leaf(Iterator first, Iterator last, T init, summation mode,
+                  instruction_set isa = best_instruction_set()) {
+  if constexpr (std::contiguous_iterator<Iterator> &&
+                std::is_arithmetic_v<T> && !std::same_as<T, bool> &&
+                std::same_as<std::iter_value_t<Iterator>, T>) {
+    if (std::is_integral_v<T> || mode != summation::in_order)
+      return init + simd_sum(std::to_address(first),
+                             static_cast<std::size_t>(last - first), mode,
+                             isa);
+  }
+  return std::accumulate(first, last, init);
+}
+
+template <typename Iterator, typename T>
+T p_accumulate(thread_pool &pool, Iterator first, Iterator last, T init,
+               std::size_t chunk_size,
+               summation mode = summation::in_order) {
+  auto distance{std::distance(first, last)};
+  if (static_cast<std::size_t>(distance) <= chunk_size) {
     if constexpr (!benchmark) {
       std::scoped_lock lock{records_mutex};
       records.emplace_back(std::this_thread::get_id(), distance);
     }
-    return std::accumulate(first, last, init);
+    return accumulate_leaf(first, last, init, mode);
   }
   auto mid{first + distance / 2};
   T sum1{init};
-  std::thread thread{[&] { sum1 += p_accumulate(first, mid, init); }};
-  T sum2{p_accumulate(mid, last, init) - init};
-  thread.join();
+  std::exception_ptr error1{nullptr};
+  std::atomic<bool> is_done{false};
+  pool.spawn([&] {
+    try {
+      sum1 = p_accumulate(pool, first, mid, init, chunk_size, mode);
+    } catch (...) {
+      error1 = std::current_exception();
+    }
+    is_done.store(true);
+  });
+  T sum2{init};
+  std::exception_ptr error2{nullptr};
+  try {
+    sum2 = p_accumulate(pool, mid, last, init, chunk_size, mode) - init;
+  } catch (...) {
+    error2 = std::current_exception();
+  }
+  // the spawned half refers to this frame, so it has to finish either way
+  pool.wait_until([&is_done] { return is_done.load(); });
+  if (error1) std::rethrow_exception(error1);
+  if (error2) std::rethrow_exception(error2);
   return sum1 + sum2;
 }
 
+template <typename Iterator, typename T>
+T p_accumulate(thread_pool &pool, Iterator first, Iterator last, T init,
+               summation mode = summation::in_order) {
+  return p_accumulate(pool, first, last, init,
+                      chunk_size_for(std::distance(first, last), pool.size()),
+                      mode);
+}
+
+thread_pool &default_pool() {
+  static thread_pool pool;
+  return pool;
+}
+
+template <typename Iterator, typename T>
+T p_accumulate(Iterator first, Iterator last, T init,
+               summation mode = summation::in_order) {
+  return p_accumulate(default_pool(), first, last, init, mode);
+}
+
+/// best of a few runs, in seconds
+template <typename Sum>
+double time_sum(Sum sum, long long expected) {
+  double best{std::numeric_limits<double>::max()};
+  for (int i{0}; i < 5; ++i) {
+    auto start_time{std::chrono::steady_clock::now()};
+    long long result{sum()};
+    auto elapsed{std::chrono::steady_clock::now() - start_time};
+    assert(result == expected);
+    best = std::min(best, std::chrono::duration<double>(elapsed).count());
+  }
+  return best;
+}
+
+std::vector<instruction_set> available_instruction_sets() {
+  std::vector<instruction_set> isas{instruction_set::scalar};
+  for (auto isa : {instruction_set::sse2, instruction_set::avx2})
+    if (isa <= best_instruction_set()) isas.push_back(isa);
+  return isas;
+}
+
+const char *name_of(instruction_set isa) {
+  switch (isa) {
+    case instruction_set::scalar:
+      return "scalar";
+    case instruction_set::sse2:
+      return "sse2";
+    case instruction_set::avx2:
+      return "avx2";
+  }
+  return "?";
+}
+
+const char *name_of(summation mode) {
+  switch (mode) {
+    case summation::in_order:
+      return "in_order";
+    case summation::reassociate:
+      return "reassociate";
+    case summation::kahan:
+      return "kahan";
+    case summation::pairwise:
+      return "pairwise";
+  }
+  return "?";
+}
+
+/// integer leaves give exactly what std::accumulate gives, over sizes that
+/// leave every possible tail behind the vector loop
+template <typename T>
+void check_integer_leaves() {
+  std::vector<T> v(1'000);
+  std::default_random_engine engine{};
+  std::uniform_int_distribution<int> distribution{-100, 100};
+  for (auto &x : v) x = static_cast<T>(distribution(engine));
+  for (auto isa : available_instruction_sets())
+    for (std::size_t n{0}; n <= v.size(); n += n < 100 ? 1 : 99)
+      assert(accumulate_leaf(v.begin(), v.begin() + n, T{1},
+                             summation::in_order, isa) ==
+             std::accumulate(v.begin(), v.begin() + n, T{1}));
+}
+
+/// a running sum that throws once it reaches the poisoned value
+struct poisoned_sum {
+  static constexpr long long poison{-1};
+  long long value{0};
+  friend poisoned_sum operator+(poisoned_sum sum, long long x) {
+    if (x == poison) throw std::runtime_error{"poisoned"};
+    return {sum.value + x};
+  }
+  friend poisoned_sum operator+(poisoned_sum a, poisoned_sum b) {
+    return {a.value + b.value};
+  }
+  friend poisoned_sum operator-(poisoned_sum a, poisoned_sum b) {
+    return {a.value - b.value};
+  }
+};
+
+/// a throw from either half, or both, reaches the caller only after the
+/// spawned half is done with the frame it points into
+void check_exceptions(thread_pool &pool) {
+  std::vector<long long> v(100'000, 1);
+  for (std::size_t poisoned : {std::size_t{0}, v.size() / 2, v.size() - 1}) {
+    v[poisoned] = poisoned_sum::poison;
+    bool thrown{false};
+    try {
+      p_accumulate(pool, v.begin(), v.end(), poisoned_sum{}, 1'000);
+    } catch (const std::runtime_error &) {
+      thrown = true;
+    }
+    assert(thrown);
+  }
+  std::fill(v.begin(), v.end(), 1);
+  assert(p_accumulate(pool, v.begin(), v.end(), poisoned_sum{}, 1'000).value ==
+         100'000);
+}
+
+/// one tenth added up ten million times drifts far off in a single float
+void check_float_leaves() {
+  const std::size_t n{10'000'000};
+  std::vector<float> v(n, 0.1f);
+  const double exact{static_cast<double>(n) * 0.1f};
+  auto error = [exact](float sum) { return std::abs(sum - exact) / exact; };
+  double in_order_error{error(std::accumulate(v.begin(), v.end(), 0.0f))};
+  assert(in_order_error > 1e-2);
+  for (auto isa : available_instruction_sets()) {
+    assert(accumulate_leaf(v.begin(), v.end(), 0.0f, summation::in_order,
+                           isa) == std::accumulate(v.begin(), v.end(), 0.0f));
+    assert(error(accumulate_leaf(v.begin(), v.end(), 0.0f,
+                                 summation::reassociate, isa)) <
+           in_order_error);
+    assert(error(accumulate_leaf(v.begin(), v.end(), 0.0f, summation::kahan,
+                                 isa)) < 1e-6);
+    assert(error(accumulate_leaf(v.begin(), v.end(), 0.0f,
+                                 summation::pairwise, isa)) < 1e-6);
+  }
+}
+
+/// GB/s of a single thread summing the same n elements over and over, which
+/// stay in the cache while n is small
+template <typename T>
+void report_leaf(const char *type_name, std::size_t n,
+                 std::vector<summation> modes) {
+  std::vector<T> v(n, T{1});
+  // read anew every time, so that the sums are not hoisted out of the loop
+  const T *volatile data{v.data()};
+  const std::size_t n_repetitions{std::max<std::size_t>(1, (1 << 28) / n)};
+  auto measure = [&](auto sum) {
+    double best{std::numeric_limits<double>::max()};
+    for (int i{0}; i < 3; ++i) {
+      auto start_time{std::chrono::steady_clock::now()};
+      T total{};
+      for (std::size_t repetition{0}; repetition < n_repetitions;
+           ++repetition) {
+        const T *first{data};
+        total += sum(first, first + n);
+      }
+      auto elapsed{std::chrono::steady_clock::now() - start_time};
+      assert(total != T{});
+      best = std::min(best, std::chrono::duration<double>(elapsed).count());
+    }
+    return 1e-9 * n_repetitions * n * sizeof(T) / best;
+  };
+  auto std_accumulate = [](const T *first, const T *last) {
+    return std::accumulate(first, last, T{});
+  };
+  std::cout << "leaf\t" << type_name << '\t' << n << " elements\t"
+            << "std::accumulate " << measure(std_accumulate) << " GB/s";
+  for (auto mode : modes)
+    for (auto isa : available_instruction_sets())
+      std::cout << '\t' << name_of(mode) << '/' << name_of(isa) << ' '
+                << measure([mode, isa](const T *first, const T *last) {
+                     return accumulate_leaf(first, last, T{}, mode, isa);
+                   })
+                << " GB/s";
+  std::cout << '\n';
+}
+
 int main() {
   std::vector<long long> v(200'000'000);
   std::iota(v.begin(), v.end(), 1);
-  auto tp{std::chrono::system_clock::now()};
+  const auto n{static_cast<long long>(v.size())};
+  const long long expected{n * (n + 1) / 2};
   auto sum{std::accumulate(v.begin(), v.end(), 0LL)};
-  auto tp_s{std::chrono::system_clock::now()};
+  assert(sum == expected);
   auto p_sum{p_accumulate(v.begin(), v.end(), 0LL)};
-  auto tp_p{std::chrono::system_clock::now()};
-  assert(sum == p_sum);
-  auto d_s{tp_s - tp};
-  auto d_p{tp_p - tp_s};
-  if constexpr (benchmark) {
-    assert(d_s > d_p * 2);
-  } else {
+  assert(p_sum == expected);
+  if constexpr (!benchmark) {
+    const std::size_t chunk_size{chunk_size_for(
+        v.size(), std::max(1U, std::thread::hardware_concurrency()))};
     assert(std::all_of(records.begin(), records.end(),
-                       [](const std::pair<std::thread::id, std::size_t> &p) {
-                         return p.second <= threshold;
+                       [chunk_size](const auto &p) {
+                         return p.second <= chunk_size;
                        }));
+    std::size_t n_summed{0};
+    for (auto &record : records) n_summed += record.second;
+    assert(n_summed == v.size());
+
+    // tasks spawned from inside the pool, and pools of a single thread
+    thread_pool pool{3};
+    assert(p_accumulate(pool, v.begin(), v.end(), 0LL, 1 << 20) == expected);
+    thread_pool lone_pool{1};
+    assert(p_accumulate(lone_pool, v.begin(), v.begin() + 1'000'000, 0LL,
+                        1'000) == 500'000'500'000LL);
+
+    check_exceptions(pool);
+    check_exceptions(lone_pool);
+    check_integer_leaves<long long>();
+    check_integer_leaves<int>();
+    check_integer_leaves<std::int8_t>();
+    check_float_leaves();
+    std::vector<double> halves(1'000'001, 0.5);
+    for (auto mode : {summation::reassociate, summation::kahan,
+                      summation::pairwise})
+      assert(p_accumulate(pool, halves.begin(), halves.end(), 0.0, mode) ==
+             500'000.5);
   }
-}
\ No newline at end of file
+
+  if constexpr (benchmark) {
+    const double gigabytes{1e-9 * v.size() * sizeof(v[0])};
+    double sequential{time_sum(
+        [&v] { return std::accumulate(v.begin(), v.end(), 0LL); }, expected)};
+    std::cout << "std::accumulate\t1 threads\t" << sequential << " s\t"
+              << gigabytes / sequential << " GB/s\n";
+    double spawning{time_sum(
+        [&v] { return spawning_p_accumulate(v.begin(), v.end(), 0LL); },
+        expected)};
+    std::size_t n_leaves{1};
+    for (std::size_t distance{v.size()}; distance > threshold;
+         distance -= distance / 2)
+      n_leaves *= 2;
+    std::cout << "thread_per_split\t" << n_leaves << " threads\t"
+              << spawning << " s\t" << gigabytes / spawning << " GB/s\t"
+              << sequential / spawning << "x\n";
+    const unsigned max_threads{
+        std::max(1U, std::thread::hardware_concurrency())};
+    for (unsigned n_threads{1};; n_threads = std::min(2 * n_threads,
+                                                       max_threads)) {
+      thread_pool pool{n_threads};
+      double pooled{time_sum(
+          [&] { return p_accumulate(pool, v.begin(), v.end(), 0LL); },
+          expected)};
+      std::cout << "work_stealing_pool\t" << n_threads << " threads\t"
+                << pooled << " s\t" << gigabytes / pooled << " GB/s\t"
+                << sequential / pooled << "x\n";
+      if (n_threads == max_threads) break;
+    }
+
+    const std::vector<summation> float_modes{
+        summation::reassociate, summation::kahan, summation::pairwise};
+    for (std::size_t n : {std::size_t{1} << 12, std::size_t{1} << 24}) {
+      report_leaf<long long>("long long", n, {summation::in_order});
+      report_leaf<int>("int", n, {summation::in_order});
+      report_leaf<double>("double", n, float_modes);
+      report_leaf<float>("float", n, float_modes);
+    }
+  }
+}
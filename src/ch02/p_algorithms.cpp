@@ -0,0 +1,620 @@
+//
+// Created by iphelf on 2026-10-17.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <execution>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifdef BENCHMARK
+constexpr bool benchmark{true};
+#else
+constexpr bool benchmark{false};
+#endif
+
+/// fork-join pool: every worker pushes the tasks it spawns to the front of its
+/// own deque and pops them from there, while idle workers steal from the back
+/// of the others' deques, so thieves take the oldest and therefore largest
+/// tasks. Threads outside the pool spawn into a shared deque. A thread that
+/// waits for a task to be done runs pending tasks meanwhile, and idle workers
+/// sleep on an atomic counter of spawned tasks after a few rounds of spinning
+class thread_pool {
+  using task = std::function<void()>;
+
+  class work_stealing_queue {
+    std::mutex mutex;
+    std::deque<task> tasks;
+
+   public:
+    void push(task t) {
+      std::scoped_lock lock{mutex};
+      tasks.push_front(std::move(t));
+    }
+    bool try_pop(task &t) {
+      std::scoped_lock lock{mutex};
+      if (tasks.empty()) return false;
+      t = std::move(tasks.front());
+      tasks.pop_front();
+      return true;
+    }
+    bool try_steal(task &t) {
+      std::scoped_lock lock{mutex};
+      if (tasks.empty()) return false;
+      t = std::move(tasks.back());
+      tasks.pop_back();
+      return true;
+    }
+  };
+
+  static constexpr int n_spins{64};
+  std::atomic<bool> done{false};
+  std::atomic<int> n_sleepers{0};
+  std::atomic<std::uint32_t> n_spawned{0};
+  work_stealing_queue shared_queue;
+  std::vector<std::unique_ptr<work_stealing_queue>> queues;
+  std::vector<std::thread> threads;
+
+  inline static thread_local thread_pool *local_pool{nullptr};
+  inline static thread_local std::size_t local_index{0};
+
+  bool try_run_pending_task() {
+    task t;
+    bool is_worker{local_pool == this};
+    bool found{is_worker && queues[local_index]->try_pop(t)};
+    if (!found) found = shared_queue.try_steal(t);
+    for (std::size_t i{1}; !found && i <= queues.size(); ++i)
+      found = queues[(local_index + i) % queues.size()]->try_steal(t);
+    if (found) t();
+    return found;
+  }
+
+  void work(std::size_t index) {
+    local_pool = this;
+    local_index = index;
+    for (int i{0}; !done.load();) {
+      if (try_run_pending_task()) {
+        i = 0;
+        continue;
+      }
+      if (++i < n_spins) {
+        std::this_thread::yield();
+        continue;
+      }
+      ++n_sleepers;
+      std::uint32_t observed_spawns{n_spawned.load()};
+      // a spawn that missed the sleeper has already published its task
+      if (!try_run_pending_task() && !done.load())
+        n_spawned.wait(observed_spawns);
+      --n_sleepers;
+      i = 0;
+    }
+  }
+
+ public:
+  /// n_threads counts the thread waiting on the pool, which runs tasks too
+  explicit thread_pool(unsigned n_threads = std::thread::hardware_concurrency())
+      : queues(std::max(1U, n_threads) - 1) {
+    for (auto &queue : queues) queue = std::make_unique<work_stealing_queue>();
+    for (std::size_t i{0}; i < queues.size(); ++i)
+      threads.emplace_back(&thread_pool::work, this, i);
+  }
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+  ~thread_pool() {
+    done.store(true);
+    ++n_spawned;
+    n_spawned.notify_all();
+    for (auto &thread : threads) thread.join();
+  }
+
+  std::size_t size() const { return queues.size() + 1; }
+
+  template <typename F>
+  void spawn(F f) {
+    if (local_pool == this)
+      queues[local_index]->push(std::move(f));
+    else
+      shared_queue.push(std::move(f));
+    ++n_spawned;
+    if (n_sleepers.load() > 0) n_spawned.notify_one();
+  }
+
+  /// runs pending tasks until is_done holds
+  template <typename IsDone>
+  void wait_until(IsDone is_done) {
+    while (!is_done())
+      if (!try_run_pending_task()) std::this_thread::yield();
+  }
+};
+
+/// splits into tasks_per_thread leaves per thread for the thieves to balance,
+/// but not into leaves so small that spawning them costs more than running
+/// them. The default minimum suits cheap per-element work and may be lowered
+/// for expensive one
+struct grain_size_policy {
+  std::size_t tasks_per_thread{8};
+  std::size_t min_grain_size{1 << 14};
+
+  std::size_t operator()(std::size_t distance, std::size_t n_threads) const {
+    const std::size_t n_tasks{std::max<std::size_t>(
+        1, n_threads * tasks_per_thread)};
+    return std::max<std::size_t>({1, min_grain_size,
+                                  (distance + n_tasks - 1) / n_tasks});
+  }
+};
+
+/// where the algorithms below run and how finely they split their ranges
+struct scheduler {
+  thread_pool &pool;
+  grain_size_policy grain_size{};
+
+  std::size_t grain_size_for(std::size_t distance) const {
+    return grain_size(distance, pool.size());
+  }
+};
+
+scheduler default_scheduler() {
+  static thread_pool pool;
+  return {pool};
+}
+
+/// halves [first, last) down to leaves of at most grain_size elements and
+/// combines the results of neighbouring halves. The right half is left to the
+/// thieves while this thread goes on with the left one, so that a lone thread
+/// visits the leaves from left to right
+template <typename Iterator, typename Leaf, typename Combine>
+auto fork_join(thread_pool &pool, Iterator first, Iterator last,
+               std::size_t grain_size, const Leaf &leaf,
+               const Combine &combine)
+    -> std::invoke_result_t<const Leaf &, Iterator, Iterator> {
+  using result = std::invoke_result_t<const Leaf &, Iterator, Iterator>;
+  auto distance{last - first};
+  if (static_cast<std::size_t>(distance) <= grain_size)
+    return leaf(first, last);
+  auto mid{first + distance / 2};
+  std::optional<result> right;
+  std::exception_ptr right_error{nullptr};
+  std::atomic<bool> is_done{false};
+  pool.spawn([&] {
+    try {
+      right.emplace(fork_join(pool, mid, last, grain_size, leaf, combine));
+    } catch (...) {
+      right_error = std::current_exception();
+    }
+    is_done.store(true);
+  });
+  std::optional<result> left;
+  std::exception_ptr left_error{nullptr};
+  try {
+    left.emplace(fork_join(pool, first, mid, grain_size, leaf, combine));
+  } catch (...) {
+    left_error = std::current_exception();
+  }
+  // the spawned half refers to this frame, so it has to finish either way
+  pool.wait_until([&is_done] { return is_done.load(); });
+  if (left_error) std::rethrow_exception(left_error);
+  if (right_error) std::rethrow_exception(right_error);
+  return combine(std::move(*left), std::move(*right));
+}
+
+/// what the leaves of algorithms without a result return
+struct none {};
+
+template <typename Iterator, typename F>
+void parallel_for_each(scheduler s, Iterator first, Iterator last, F f) {
+  fork_join(
+      s.pool, first, last, s.grain_size_for(last - first),
+      [&f](Iterator first, Iterator last) {
+        std::for_each(first, last, std::ref(f));
+        return none{};
+      },
+      [](none, none) { return none{}; });
+}
+
+template <typename Iterator, typename F>
+void parallel_for_each(Iterator first, Iterator last, F f) {
+  parallel_for_each(default_scheduler(), first, last, std::move(f));
+}
+
+/// unlike std::transform_reduce, keeps the elements in order, so reduce only
+/// has to be associative
+template <typename Iterator, typename T, typename Reduce, typename Transform>
+T parallel_transform_reduce(scheduler s, Iterator first, Iterator last,
+                            T init, Reduce reduce, Transform transform) {
+  if (first == last) return init;
+  // every leaf starts from its own first element, as init is not an identity
+  T sum{fork_join(
+      s.pool, first, last, s.grain_size_for(last - first),
+      [&](Iterator first, Iterator last) {
+        T sum{transform(*first)};
+        for (++first; first != last; ++first)
+          sum = reduce(std::move(sum), transform(*first));
+        return sum;
+      },
+      [&reduce](T left, T right) {
+        return reduce(std::move(left), std::move(right));
+      })};
+  return reduce(std::move(init), std::move(sum));
+}
+
+template <typename Iterator, typename T, typename Reduce, typename Transform>
+T parallel_transform_reduce(Iterator first, Iterator last, T init,
+                            Reduce reduce, Transform transform) {
+  return parallel_transform_reduce(default_scheduler(), first, last,
+                                   std::move(init), std::move(reduce),
+                                   std::move(transform));
+}
+
+/// the leaves share the position of the leftmost match found so far, and give
+/// up once they only have elements after it left, checking every few elements
+/// rather than after each one
+template <typename Iterator, typename Predicate>
+Iterator parallel_find_if(scheduler s, Iterator first, Iterator last,
+                          Predicate predicate) {
+  using difference_type = std::iter_difference_t<Iterator>;
+  constexpr difference_type check_interval{1024};
+  const difference_type distance{last - first};
+  std::atomic<difference_type> found{distance};
+  fork_join(
+      s.pool, first, last, s.grain_size_for(distance),
+      [&](Iterator leaf_first, Iterator leaf_last) {
+        for (difference_type i{leaf_first - first}, end{leaf_last - first};
+             i < end && i < found.load(std::memory_order_relaxed);) {
+          for (difference_type block_end{std::min(end, i + check_interval)};
+               i < block_end; ++i)
+            if (predicate(first[i])) {
+              difference_type leftmost{found.load(std::memory_order_relaxed)};
+              while (i < leftmost &&
+                     !found.compare_exchange_weak(leftmost, i,
+                                                  std::memory_order_relaxed))
+                ;
+              return none{};
+            }
+        }
+        return none{};
+      },
+      [](none, none) { return none{}; });
+  // fork_join waited for every leaf, which orders their stores before this
+  return first + found.load(std::memory_order_relaxed);
+}
+
+template <typename Iterator, typename Predicate>
+Iterator parallel_find_if(Iterator first, Iterator last, Predicate predicate) {
+  return parallel_find_if(default_scheduler(), first, last,
+                          std::move(predicate));
+}
+
+template <typename Iterator, typename T>
+Iterator parallel_find(scheduler s, Iterator first, Iterator last,
+                       const T &value) {
+  return parallel_find_if(s, first, last,
+                          [&value](const auto &x) { return x == value; });
+}
+
+template <typename Iterator, typename T>
+Iterator parallel_find(Iterator first, Iterator last, const T &value) {
+  return parallel_find(default_scheduler(), first, last, value);
+}
+
+/// two passes over blocks of grain_size elements: the first reduces every
+/// block but the last, the carries into the blocks are then scanned in
+/// sequence, and the second pass scans every block from its carry. An
+/// exclusive scan always has a carry, starting with init; an inclusive one has
+/// none into the first block unless given an init. A lone thread reads the
+/// elements only once, in a single block
+template <bool inclusive, typename InputIterator, typename OutputIterator,
+          typename T, typename Operation>
+OutputIterator blocked_scan(scheduler s, InputIterator first,
+                            InputIterator last, OutputIterator d_first,
+                            std::optional<T> init, Operation operation) {
+  struct block {
+    InputIterator first;
+    InputIterator last;
+    OutputIterator d_first;
+    std::optional<T> sum;
+    std::optional<T> carry;
+  };
+  const auto distance{last - first};
+  const auto grain_size{static_cast<decltype(distance)>(
+      s.pool.size() == 1 ? distance : s.grain_size_for(distance))};
+  std::vector<block> blocks;
+  for (auto offset{decltype(distance){0}}; offset < distance;
+       offset += grain_size)
+    blocks.push_back({first + offset,
+                      first + std::min(distance, offset + grain_size),
+                      d_first + offset, {}, {}});
+  if (blocks.size() > 1)
+    parallel_for_each(
+        scheduler{s.pool, {.min_grain_size = 1}}, blocks.begin(),
+        blocks.end() - 1, [&operation](block &b) {
+          b.sum.emplace(std::accumulate(std::next(b.first), b.last,
+                                        T(*b.first), operation));
+        });
+  std::optional<T> carry{std::move(init)};
+  for (auto &b : blocks) {
+    b.carry = carry;
+    if (b.sum) carry = carry ? operation(*carry, *b.sum) : *b.sum;
+  }
+  parallel_for_each(scheduler{s.pool, {.min_grain_size = 1}}, blocks.begin(),
+                    blocks.end(), [&operation](block &b) {
+                      if constexpr (!inclusive)
+                        std::exclusive_scan(b.first, b.last, b.d_first,
+                                            *b.carry, operation);
+                      else if (b.carry)
+                        std::inclusive_scan(b.first, b.last, b.d_first,
+                                            operation, *b.carry);
+                      else
+                        std::inclusive_scan(b.first, b.last, b.d_first,
+                                            operation);
+                    });
+  return d_first + distance;
+}
+
+/// d_first may be first, to scan in place
+template <typename InputIterator, typename OutputIterator,
+          typename Operation = std::plus<>>
+OutputIterator parallel_inclusive_scan(scheduler s, InputIterator first,
+                                       InputIterator last,
+                                       OutputIterator d_first,
+                                       Operation operation = {}) {
+  using T = std::iter_value_t<InputIterator>;
+  return blocked_scan<true>(s, first, last, d_first, std::optional<T>{},
+                            std::move(operation));
+}
+
+template <typename InputIterator, typename OutputIterator, typename Operation,
+          typename T>
+OutputIterator parallel_inclusive_scan(scheduler s, InputIterator first,
+                                       InputIterator last,
+                                       OutputIterator d_first,
+                                       Operation operation, T init) {
+  return blocked_scan<true>(s, first, last, d_first,
+                            std::optional<T>{std::move(init)},
+                            std::move(operation));
+}
+
+template <typename InputIterator, typename OutputIterator,
+          typename Operation = std::plus<>>
+OutputIterator parallel_inclusive_scan(InputIterator first, InputIterator last,
+                                       OutputIterator d_first,
+                                       Operation operation = {}) {
+  return parallel_inclusive_scan(default_scheduler(), first, last, d_first,
+                                 std::move(operation));
+}
+
+template <typename InputIterator, typename OutputIterator, typename T,
+          typename Operation = std::plus<>>
+OutputIterator parallel_exclusive_scan(scheduler s, InputIterator first,
+                                       InputIterator last,
+                                       OutputIterator d_first, T init,
+                                       Operation operation = {}) {
+  return blocked_scan<false>(s, first, last, d_first,
+                             std::optional<T>{std::move(init)},
+                             std::move(operation));
+}
+
+template <typename InputIterator, typename OutputIterator, typename T,
+          typename Operation = std::plus<>>
+OutputIterator parallel_exclusive_scan(InputIterator first, InputIterator last,
+                                       OutputIterator d_first, T init,
+                                       Operation operation = {}) {
+  return parallel_exclusive_scan(default_scheduler(), first, last, d_first,
+                                 std::move(init), std::move(operation));
+}
+
+/// against the sequential std:: algorithms, on every size up to n and leaves
+/// of a few elements, with strings, whose concatenation does not commute
+void check(scheduler s, std::size_t n) {
+  std::vector<std::string> v(n);
+  for (std::size_t i{0}; i < n; ++i) v[i] = std::to_string(i % 10);
+  auto to_string = [](const std::string &x) { return x; };
+  for (std::size_t size{0}; size <= n; ++size) {
+    auto first{v.begin()};
+    auto last{v.begin() + size};
+    assert(parallel_transform_reduce(s, first, last, std::string{"<"},
+                                     std::plus<>{}, to_string) ==
+           std::accumulate(first, last, std::string{"<"}));
+
+    std::vector<std::string> expected(size);
+    std::vector<std::string> result(size);
+    std::inclusive_scan(first, last, expected.begin());
+    assert(parallel_inclusive_scan(s, first, last, result.begin()) ==
+           result.end());
+    assert(result == expected);
+    std::inclusive_scan(first, last, expected.begin(), std::plus<>{},
+                        std::string{"<"});
+    parallel_inclusive_scan(s, first, last, result.begin(), std::plus<>{},
+                            std::string{"<"});
+    assert(result == expected);
+    std::exclusive_scan(first, last, expected.begin(), std::string{"<"});
+    assert(parallel_exclusive_scan(s, first, last, result.begin(),
+                                   std::string{"<"}) == result.end());
+    assert(result == expected);
+
+    std::vector<int> counts(size, 0);
+    parallel_for_each(s, counts.begin(), counts.end(), [](int &x) { ++x; });
+    assert(std::all_of(counts.begin(), counts.end(),
+                       [](int x) { return x == 1; }));
+    std::iota(counts.begin(), counts.end(), 0);
+    parallel_inclusive_scan(s, counts.begin(), counts.end(), counts.begin());
+    for (std::size_t i{0}; i < size; ++i)
+      assert(counts[i] == static_cast<int>(i * (i + 1) / 2));
+
+    for (const char *digit : {"0", "7", "9", "x"})
+      assert(parallel_find(s, first, last, std::string{digit}) ==
+             std::find(first, last, std::string{digit}));
+  }
+}
+
+/// best of a few runs, in seconds
+template <typename F>
+double time_best(F f) {
+  double best{std::numeric_limits<double>::max()};
+  for (int i{0}; i < 5; ++i) {
+    auto start_time{std::chrono::steady_clock::now()};
+    f();
+    auto elapsed{std::chrono::steady_clock::now() - start_time};
+    best = std::min(best, std::chrono::duration<double>(elapsed).count());
+  }
+  return best;
+}
+
+template <typename Sequential, typename Par, typename Parallel>
+void report(const char *name, std::size_t n, Sequential sequential, Par par,
+            Parallel parallel) {
+  double sequential_time{time_best(sequential)};
+  double par_time{time_best(par)};
+  double parallel_time{time_best(parallel)};
+  std::cout << name << '\t' << n << " elements\t"
+            << "std:: " << sequential_time << " s\t"
+            << "std::execution::par " << par_time << " s\t"
+            << sequential_time / par_time << "x\t"
+            << "scheduler " << parallel_time << " s\t"
+            << sequential_time / parallel_time << "x\n";
+}
+
+int main() {
+  thread_pool pool{3};
+  thread_pool lone_pool{1};
+  if constexpr (!benchmark) {
+    for (std::size_t min_grain_size : {1, 3, 16}) {
+      check({pool, {.min_grain_size = min_grain_size}}, 100);
+      check({lone_pool, {.min_grain_size = min_grain_size}}, 20);
+    }
+
+    std::vector<long long> v(10'000'000);
+    std::iota(v.begin(), v.end(), 0);
+    const auto n{static_cast<long long>(v.size())};
+    // the squares add up past long long beyond a few million elements
+    auto square = [](long long x) { return x * x; };
+    assert(parallel_transform_reduce(v.begin(), v.begin() + 1'000'000, 0LL,
+                                     std::plus<>{}, square) ==
+           333'332'833'333'500'000LL);
+    std::vector<long long> sums(v.size());
+    parallel_exclusive_scan(v.begin(), v.end(), sums.begin(), 0LL);
+    assert(sums.back() == (n - 1) * (n - 2) / 2);
+    parallel_inclusive_scan(v.begin(), v.end(), sums.begin());
+    assert(sums.back() == n * (n - 1) / 2);
+    assert(parallel_find(v.begin(), v.end(), n / 3) == v.begin() + n / 3);
+    assert(parallel_find(v.begin(), v.end(), -1LL) == v.end());
+
+    // a lone thread stops soon after the match, like std::find_if
+    std::atomic<long long> n_calls{0};
+    assert(parallel_find_if({lone_pool}, v.begin(), v.end(),
+                            [&n_calls](long long x) {
+                              ++n_calls;
+                              return x == 1000;
+                            }) == v.begin() + 1000);
+    assert(n_calls.load() < 100'000);
+
+    // exceptions reach the caller only after all leaves are done
+    for (auto *p : {&pool, &lone_pool}) {
+      std::atomic<long long> n_visited{0};
+      try {
+        parallel_for_each({*p, {.min_grain_size = 100}}, v.begin(),
+                          v.begin() + 100'000, [&n_visited](long long x) {
+                            ++n_visited;
+                            if (x == 54'321) throw std::runtime_error{"x"};
+                          });
+        assert(false);
+      } catch (const std::runtime_error &) {
+      }
+      assert(n_visited.load() <= 100'000);
+    }
+  }
+
+  if constexpr (benchmark) {
+    const std::size_t n{50'000'000};
+    std::vector<long long> v(n);
+    std::default_random_engine engine{};
+    std::uniform_int_distribution<long long> distribution{0, 999};
+    for (auto &x : v) x = distribution(engine);
+    std::vector<long long> sums(n);
+    auto square = [](long long x) { return x * x; };
+    auto increment = [](long long &x) { ++x; };
+    const auto needle{v.begin() + n * 3 / 4};
+    *needle = -1;
+
+    report(
+        "for_each", n,
+        [&] { std::for_each(v.begin(), v.end(), increment); },
+        [&] {
+          std::for_each(std::execution::par, v.begin(), v.end(), increment);
+        },
+        [&] { parallel_for_each(v.begin(), v.end(), increment); });
+    std::for_each(v.begin(), v.end(), [](long long &x) { x %= 1000; });
+    *needle = 0;
+    const long long sum{std::transform_reduce(v.begin(), v.end(), 0LL,
+                                              std::plus<>{}, square)};
+    auto check_sum = [sum](long long result) {
+      if (result != sum) std::cerr << "wrong transform_reduce\n";
+    };
+    report(
+        "transform_reduce", n,
+        [&] {
+          check_sum(std::transform_reduce(v.begin(), v.end(), 0LL,
+                                          std::plus<>{}, square));
+        },
+        [&] {
+          check_sum(std::transform_reduce(std::execution::par, v.begin(),
+                                          v.end(), 0LL, std::plus<>{},
+                                          square));
+        },
+        [&] {
+          check_sum(parallel_transform_reduce(v.begin(), v.end(), 0LL,
+                                              std::plus<>{}, square));
+        });
+    *needle = -1;
+    auto check_found = [needle](auto it) {
+      if (it != needle) std::cerr << "wrong find\n";
+    };
+    report(
+        "find at 3/4", n,
+        [&] { check_found(std::find(v.begin(), v.end(), -1LL)); },
+        [&] {
+          check_found(
+              std::find(std::execution::par, v.begin(), v.end(), -1LL));
+        },
+        [&] { check_found(parallel_find(v.begin(), v.end(), -1LL)); });
+    *needle = 0;
+    report(
+        "inclusive_scan", n,
+        [&] { std::inclusive_scan(v.begin(), v.end(), sums.begin()); },
+        [&] {
+          std::inclusive_scan(std::execution::par, v.begin(), v.end(),
+                              sums.begin());
+        },
+        [&] { parallel_inclusive_scan(v.begin(), v.end(), sums.begin()); });
+    report(
+        "exclusive_scan", n,
+        [&] { std::exclusive_scan(v.begin(), v.end(), sums.begin(), 0LL); },
+        [&] {
+          std::exclusive_scan(std::execution::par, v.begin(), v.end(),
+                              sums.begin(), 0LL);
+        },
+        [&] {
+          parallel_exclusive_scan(v.begin(), v.end(), sums.begin(), 0LL);
+        });
+    if (sums.back() + v.back() != std::reduce(v.begin(), v.end()))
+      std::cerr << "wrong exclusive_scan\n";
+  }
+}
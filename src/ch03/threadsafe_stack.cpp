@@ -2,22 +2,133 @@
 // Created by iphelf on 2023-09-24.
 //
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
-// #include <iostream>
+#include <chrono>
+#include <iostream>
+#include <iterator>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <random>
 #include <stack>
+#include <stdexcept>
+#include <string>
 #include <thread>
+#include <type_traits>
+#include <variant>
+#include <vector>
 
+#ifdef BENCHMARK
+constexpr bool benchmark{true};
+#else
+constexpr bool benchmark{false};
+#endif
+
+constexpr std::size_t cache_line_size{64};
+
+/// lets a push and a pop that meet in the same slot hand the item over
+/// directly, without touching the stack itself
 template <typename T>
+class elimination_array {
+  enum slot_state : int { vacant, writing, offered, reading, taken };
+  struct alignas(cache_line_size) slot {
+    std::atomic<int> state{vacant};
+    std::optional<T> item{};
+  };
+  static constexpr std::size_t max_slots{16};
+  static constexpr int n_spins{128};
+  slot slots[max_slots];
+  // at most half of the threads can be pushers waiting in a slot, and
+  // spreading them wider only makes pops miss them
+  const std::size_t n_slots{std::clamp<std::size_t>(
+      std::thread::hardware_concurrency() / 2, 1, max_slots)};
+
+  slot &pick() {
+    thread_local std::minstd_rand engine{std::random_device{}()};
+    return slots[engine() % n_slots];
+  }
+
+ public:
+  /// on failure, item is left untouched
+  bool try_give(T &item) {
+    slot &s{pick()};
+    int expected{vacant};
+    if (!s.state.compare_exchange_strong(expected, writing,
+                                         std::memory_order_acquire))
+      return false;
+    s.item.emplace(std::move(item));
+    s.state.store(offered, std::memory_order_release);
+    for (int i{0}; i < n_spins; ++i)
+      if (s.state.load(std::memory_order_acquire) == taken) {
+        s.state.store(vacant, std::memory_order_release);
+        return true;
+      }
+    expected = offered;
+    if (s.state.compare_exchange_strong(expected, writing,
+                                        std::memory_order_acquire)) {
+      item = std::move(*s.item);
+      s.item.reset();
+      s.state.store(vacant, std::memory_order_release);
+      return false;
+    }
+    // a pop has claimed the item and is moving it out
+    while (s.state.load(std::memory_order_acquire) != taken)
+      std::this_thread::yield();
+    s.state.store(vacant, std::memory_order_release);
+    return true;
+  }
+  std::optional<T> try_take() {
+    slot &s{pick()};
+    for (int i{0}; i < n_spins; ++i) {
+      int expected{offered};
+      if (s.state.load(std::memory_order_relaxed) == offered &&
+          s.state.compare_exchange_strong(expected, reading,
+                                          std::memory_order_acquire)) {
+        std::optional<T> popped{std::move(s.item)};
+        s.item.reset();
+        s.state.store(taken, std::memory_order_release);
+        return popped;
+      }
+    }
+    return std::nullopt;
+  }
+};
+
+enum class stack_mode {
+  locking,
+  /// a push and a pop that find the mutex taken try to meet in an
+  /// elimination_array before retrying it
+  elimination,
+};
+
+template <typename T, stack_mode mode = stack_mode::locking>
 class threadsafe_stack {
   mutable std::mutex mutex{};
   std::stack<T> data{};
   int n_log{0};
+  [[no_unique_address]] std::conditional_t<mode == stack_mode::elimination,
+                                           elimination_array<T>, std::monostate>
+      eliminator{};
   void log() {
     // std::cout << '#' << n_log << ": " << data.size() << '\n';
     ++n_log;
   }
+  /// the returned lock owns nothing if eliminate succeeded instead
+  template <typename Eliminate>
+  std::unique_lock<std::mutex> lock_or_eliminate(Eliminate eliminate) {
+    if constexpr (mode == stack_mode::elimination) {
+      std::unique_lock lock{mutex, std::try_to_lock};
+      while (!lock.owns_lock()) {
+        if (eliminate()) break;
+        lock.try_lock();
+      }
+      return lock;
+    } else {
+      return std::unique_lock{mutex};
+    }
+  }
 
  public:
   threadsafe_stack() = default;
@@ -29,15 +140,30 @@ class threadsafe_stack {
   threadsafe_stack(threadsafe_stack &&) = delete;
   threadsafe_stack &operator=(threadsafe_stack &&) = delete;
   std::unique_ptr<T> pop() {
-    std::lock_guard guard{mutex};
+    std::unique_ptr<T> popped;
+    auto lock{lock_or_eliminate([&] {
+      if constexpr (mode == stack_mode::elimination)
+        if (auto item{eliminator.try_take()})
+          popped = std::make_unique<T>(std::move(*item));
+      return popped != nullptr;
+    })};
+    if (!lock.owns_lock()) return popped;
     if (data.empty()) return nullptr;
-    auto popped{std::make_unique<T>(data.top())};
+    popped = std::make_unique<T>(data.top());
     data.pop();
     log();
     return popped;
   }
   bool pop(T &recipient) {
-    std::lock_guard guard{mutex};
+    auto lock{lock_or_eliminate([&] {
+      if constexpr (mode == stack_mode::elimination)
+        if (auto item{eliminator.try_take()}) {
+          recipient = std::move(*item);
+          return true;
+        }
+      return false;
+    })};
+    if (!lock.owns_lock()) return true;
     if (data.empty()) return false;
     recipient = data.top();
     data.pop();
@@ -45,21 +171,245 @@ class threadsafe_stack {
     return true;
   }
   void push(T item) {
-    std::lock_guard guard{mutex};
+    auto lock{lock_or_eliminate([&] {
+      if constexpr (mode == stack_mode::elimination)
+        return eliminator.try_give(item);
+      return false;
+    })};
+    if (!lock.owns_lock()) return;
     data.push(std::move(item));
     log();
   }
+  template <typename InputIt>
+  void push_range(InputIt first, InputIt last) {
+    std::lock_guard guard{mutex};
+    for (; first != last; ++first) data.push(*first);
+    log();
+  }
+  /// returns the number of items popped, which is less than n only if the
+  /// stack ran empty
+  template <typename OutputIt>
+  std::size_t pop_n(OutputIt out, std::size_t n) {
+    std::lock_guard guard{mutex};
+    std::size_t n_popped{0};
+    for (; n_popped < n && !data.empty(); ++n_popped) {
+      *out++ = std::move(data.top());
+      data.pop();
+    }
+    log();
+    return n_popped;
+  }
+  /// takes the whole stack in O(1), items are moved out after unlocking
+  template <typename OutputIt>
+  std::size_t pop_all(OutputIt out) {
+    std::stack<T> popped;
+    {
+      std::lock_guard guard{mutex};
+      popped.swap(data);
+      log();
+    }
+    std::size_t n_popped{popped.size()};
+    for (; !popped.empty(); popped.pop()) *out++ = std::move(popped.top());
+    return n_popped;
+  }
   [[nodiscard]] bool empty() const {
     std::lock_guard guard{mutex};
     return data.empty();
   }
 };
 
-int main() {
-  const int n_items{100'000};
-  const int n_threads{
-      std::max(static_cast<int>(std::thread::hardware_concurrency()), 2)};
-  threadsafe_stack<int> stack;
+// threads claim their hazard pointer up front, so the pool grows with the
+// machine to fit four threads per hardware thread
+const std::size_t max_hazard_pointers{
+    std::max<std::size_t>(128, 4 * std::thread::hardware_concurrency())};
+
+struct hazard_pointer {
+  std::atomic<std::thread::id> owner{};
+  std::atomic<void *> pointer{nullptr};
+};
+// never resized, so the atomics stay put
+std::vector<hazard_pointer> hazard_pointers(max_hazard_pointers);
+
+class hazard_pointer_owner {
+  hazard_pointer *hp{nullptr};
+
+ public:
+  hazard_pointer_owner() {
+    for (auto &candidate : hazard_pointers) {
+      std::thread::id no_owner{};
+      if (candidate.owner.compare_exchange_strong(no_owner,
+                                                  std::this_thread::get_id())) {
+        hp = &candidate;
+        return;
+      }
+    }
+    throw std::runtime_error{"no hazard pointers available"};
+  }
+  hazard_pointer_owner(const hazard_pointer_owner &) = delete;
+  hazard_pointer_owner &operator=(const hazard_pointer_owner &) = delete;
+  ~hazard_pointer_owner() {
+    hp->pointer.store(nullptr);
+    hp->owner.store(std::thread::id{});
+  }
+  std::atomic<void *> &get_pointer() { return hp->pointer; }
+};
+
+std::atomic<void *> &get_hazard_pointer_for_current_thread() {
+  thread_local hazard_pointer_owner owner;
+  return owner.get_pointer();
+}
+
+struct retired_node {
+  void *pointer;
+  void (*deleter)(void *);
+};
+
+// nodes retired by threads that exited while the nodes were still hazardous
+struct orphanage {
+  std::mutex mutex;
+  std::vector<retired_node> nodes;
+  ~orphanage() {
+    for (auto &node : nodes) node.deleter(node.pointer);
+  }
+} orphaned_nodes;
+
+class retired_list {
+  std::vector<retired_node> nodes;
+
+ public:
+  retired_list() = default;
+  retired_list(const retired_list &) = delete;
+  retired_list &operator=(const retired_list &) = delete;
+  ~retired_list() {
+    scan();
+    if (nodes.empty()) return;
+    std::scoped_lock lock{orphaned_nodes.mutex};
+    orphaned_nodes.nodes.insert(orphaned_nodes.nodes.end(), nodes.begin(),
+                                 nodes.end());
+  }
+  void retire(retired_node node) {
+    nodes.push_back(node);
+    // amortize each scan over a number of retirements proportional to the
+    // number of hazard pointers, so that each node costs O(1) on average
+    if (nodes.size() >= 2 * max_hazard_pointers) scan();
+  }
+  void scan() {
+    {
+      std::scoped_lock lock{orphaned_nodes.mutex};
+      nodes.insert(nodes.end(), orphaned_nodes.nodes.begin(),
+                   orphaned_nodes.nodes.end());
+      orphaned_nodes.nodes.clear();
+    }
+    std::vector<void *> hazards;
+    for (auto &hp : hazard_pointers)
+      if (void *p{hp.pointer.load()}) hazards.push_back(p);
+    std::sort(hazards.begin(), hazards.end());
+    std::erase_if(nodes, [&hazards](const retired_node &node) {
+      if (std::binary_search(hazards.begin(), hazards.end(), node.pointer))
+        return false;
+      node.deleter(node.pointer);
+      return true;
+    });
+  }
+};
+
+template <typename Node>
+void retire(Node *node) {
+  thread_local retired_list retired;
+  retired.retire(
+      {node, [](void *pointer) { delete static_cast<Node *>(pointer); }});
+}
+
+template <typename T>
+class lock_free_stack {
+  struct node {
+    T data;
+    node *next{nullptr};
+  };
+  std::atomic<node *> head{nullptr};
+
+  node *pop_node() {
+    std::atomic<void *> &hp{get_hazard_pointer_for_current_thread()};
+    node *old_head{head.load()};
+    do {
+      // re-read head until the hazard pointer is known to have been published
+      // before anyone could have unlinked and retired the node
+      node *protected_head;
+      do {
+        protected_head = old_head;
+        hp.store(old_head);
+        old_head = head.load();
+      } while (old_head != protected_head);
+    } while (old_head &&
+             !head.compare_exchange_strong(old_head, old_head->next));
+    hp.store(nullptr);
+    return old_head;
+  }
+
+ public:
+  lock_free_stack() = default;
+  lock_free_stack(const lock_free_stack &) = delete;
+  lock_free_stack &operator=(const lock_free_stack &) = delete;
+  lock_free_stack(lock_free_stack &&) = delete;
+  lock_free_stack &operator=(lock_free_stack &&) = delete;
+  ~lock_free_stack() {
+    node *next;
+    for (node *p{head.load()}; p; p = next) {
+      next = p->next;
+      delete p;
+    }
+  }
+  std::unique_ptr<T> pop() {
+    node *popped_node{pop_node()};
+    if (!popped_node) return nullptr;
+    auto popped{std::make_unique<T>(std::move(popped_node->data))};
+    retire(popped_node);
+    return popped;
+  }
+  bool pop(T &recipient) {
+    node *popped_node{pop_node()};
+    if (!popped_node) return false;
+    recipient = std::move(popped_node->data);
+    retire(popped_node);
+    return true;
+  }
+  void push(T item) {
+    node *new_node{new node{std::move(item)}};
+    new_node->next = head.load();
+    while (!head.compare_exchange_weak(new_node->next, new_node))
+      ;
+  }
+  /// links the items up privately and publishes them with a single CAS
+  template <typename InputIt>
+  void push_range(InputIt first, InputIt last) {
+    if (first == last) return;
+    node *bottom{new node{*first}};
+    node *top{bottom};
+    for (++first; first != last; ++first) top = new node{*first, top};
+    bottom->next = head.load();
+    while (!head.compare_exchange_weak(bottom->next, top))
+      ;
+  }
+  /// takes the whole stack with a single exchange
+  template <typename OutputIt>
+  std::size_t pop_all(OutputIt out) {
+    std::size_t n_popped{0};
+    node *next;
+    for (node *p{head.exchange(nullptr)}; p; p = next, ++n_popped) {
+      next = p->next;
+      *out++ = std::move(p->data);
+      // any of the nodes may have been the head when a concurrent pop
+      // protected it, so none of them can be deleted right away
+      retire(p);
+    }
+    return n_popped;
+  }
+  [[nodiscard]] bool empty() const { return !head.load(); }
+};
+
+template <typename Stack>
+std::chrono::nanoseconds stress(int n_threads, int n_items) {
+  Stack stack;
   std::stack<std::thread> threads;
   const auto start_time{std::chrono::system_clock::now() +
                         std::chrono::milliseconds(100)};
@@ -95,7 +445,148 @@ int main() {
     threads.pop();
     thread.join();
   }
+  auto elapsed{std::chrono::system_clock::now() - start_time};
   assert(threads.empty());
   assert(stack.empty());
   assert(content == 0);
+  return elapsed;
+}
+
+/// every thread pushes its items batch by batch, pops a batch after each push,
+/// and finally helps drain the stack
+template <typename Stack, typename PushBatch, typename PopBatch>
+std::chrono::nanoseconds stress_batched(int n_threads, int n_items,
+                                        int batch_size, PushBatch push_batch,
+                                        PopBatch pop_batch) {
+  Stack stack;
+  std::vector<std::thread> threads;
+  const auto start_time{std::chrono::system_clock::now() +
+                        std::chrono::milliseconds(100)};
+  const long long n_total_items{1LL * n_threads * n_items};
+  std::atomic<long long> content{0};
+  std::atomic<long long> n_popped{0};
+  for (int i{0}; i < n_threads; ++i)
+    threads.emplace_back([&] {
+      std::vector<int> batch;
+      std::vector<int> popped;
+      auto pop{[&] {
+        popped.clear();
+        pop_batch(stack, std::back_inserter(popped), batch_size);
+        for (int item : popped) content -= item;
+        n_popped += static_cast<long long>(popped.size());
+        return !popped.empty();
+      }};
+      std::this_thread::sleep_until(start_time);
+      for (int j{0}; j < n_items; j += batch_size) {
+        batch.clear();
+        for (int k{j}; k < std::min(j + batch_size, n_items); ++k) {
+          batch.push_back(k);
+          content += k;
+        }
+        push_batch(stack, batch.begin(), batch.end());
+        pop();
+      }
+      while (n_popped < n_total_items)
+        if (!pop()) std::this_thread::yield();
+    });
+  for (auto &thread : threads) thread.join();
+  auto elapsed{std::chrono::system_clock::now() - start_time};
+  assert(stack.empty());
+  assert(content == 0);
+  return elapsed;
+}
+
+const auto push_each{[](auto &stack, auto first, auto last) {
+  for (; first != last; ++first) stack.push(*first);
+}};
+const auto pop_each{[](auto &stack, auto out, std::size_t n) {
+  int item;
+  for (std::size_t i{0}; i < n && stack.pop(item); ++i) *out++ = item;
+}};
+const auto push_range{
+    [](auto &stack, auto first, auto last) { stack.push_range(first, last); }};
+const auto pop_n{
+    [](auto &stack, auto out, std::size_t n) { stack.pop_n(out, n); }};
+const auto pop_all{
+    [](auto &stack, auto out, std::size_t) { stack.pop_all(out); }};
+
+void print_throughput(const std::string &name, int n_threads, double n_ops,
+                      std::chrono::nanoseconds elapsed) {
+  std::cout << name << '\t' << n_threads << " threads\t"
+            << n_ops / std::chrono::duration<double>(elapsed).count()
+            << " ops/s\n";
+}
+
+template <typename Stack>
+void report(const char *name, int n_threads, int n_items) {
+  auto elapsed{stress<Stack>(n_threads, n_items)};
+  // every thread pushes and pops each of its items once
+  print_throughput(name, n_threads, 2.0 * n_threads * n_items, elapsed);
+}
+
+template <typename Stack, typename PushBatch, typename PopBatch>
+void report_batched(const std::string &name, int n_threads, int n_items,
+                    int batch_size, PushBatch push_batch, PopBatch pop_batch) {
+  auto elapsed{stress_batched<Stack>(n_threads, n_items, batch_size,
+                                     push_batch, pop_batch)};
+  print_throughput(name + " batch=" + std::to_string(batch_size), n_threads,
+                   2.0 * n_threads * n_items, elapsed);
+}
+
+int main() {
+  const int n_items{100'000};
+  const int n_threads{
+      std::max(static_cast<int>(std::thread::hardware_concurrency()), 2)};
+  stress<threadsafe_stack<int>>(n_threads, n_items);
+  stress<threadsafe_stack<int, stack_mode::elimination>>(n_threads, n_items);
+  stress<lock_free_stack<int>>(n_threads, n_items);
+  {
+    std::vector<int> items{1, 2, 3, 4};
+    threadsafe_stack<int> stack;
+    stack.push_range(items.begin(), items.end());
+    std::vector<int> popped;
+    assert(stack.pop_n(std::back_inserter(popped), 3) == 3);
+    assert((popped == std::vector<int>{4, 3, 2}));
+    stack.push(5);
+    assert(stack.pop_all(std::back_inserter(popped)) == 2);
+    assert((popped == std::vector<int>{4, 3, 2, 5, 1}));
+    assert(stack.empty());
+  }
+  {
+    std::vector<int> items{1, 2, 3, 4};
+    lock_free_stack<int> stack;
+    stack.push_range(items.begin(), items.end());
+    stack.push(5);
+    std::vector<int> popped;
+    assert(stack.pop_all(std::back_inserter(popped)) == 5);
+    assert((popped == std::vector<int>{5, 4, 3, 2, 1}));
+    assert(stack.empty());
+  }
+  stress_batched<threadsafe_stack<int>>(n_threads, n_items, 64, push_range,
+                                        pop_n);
+  stress_batched<lock_free_stack<int>>(n_threads, n_items, 64, push_range,
+                                       pop_all);
+  if constexpr (benchmark) {
+    for (int n{2};; n = std::min(n * 2, n_threads)) {
+      report<threadsafe_stack<int>>("threadsafe_stack", n, n_items);
+      report<threadsafe_stack<int, stack_mode::elimination>>(
+          "threadsafe_stack<elimination>", n, n_items);
+      report<lock_free_stack<int>>("lock_free_stack", n, n_items);
+      if (n == n_threads) break;
+    }
+    for (int batch_size : {16, 64, 256, 512}) {
+      report_batched<threadsafe_stack<int>>("threadsafe_stack push/pop",
+                                            n_threads, n_items, batch_size,
+                                            push_each, pop_each);
+      report_batched<threadsafe_stack<int>>(
+          "threadsafe_stack push_range/pop_n", n_threads, n_items, batch_size,
+          push_range, pop_n);
+      report_batched<lock_free_stack<int>>("lock_free_stack push/pop",
+                                           n_threads, n_items, batch_size,
+                                           push_each, pop_each);
+      report_batched<lock_free_stack<int>>(
+          "lock_free_stack push_range/pop_all", n_threads, n_items,
+          batch_size, push_range, pop_all);
+    }
+  }
 }
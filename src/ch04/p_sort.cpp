@@ -3,10 +3,36 @@
 //
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <cassert>
+#include <chrono>
+#include <concepts>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
 #include <future>
+#include <iostream>
+#include <iterator>
+#include <limits>
 #include <list>
+#include <memory>
+#include <mutex>
+#include <numeric>
 #include <random>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef BENCHMARK
+constexpr bool benchmark{true};
+#else
+constexpr bool benchmark{false};
+#endif
 
 template <typename T>
 std::list<T> sort(std::list<T> list) {
@@ -25,18 +51,835 @@ std::list<T> sort(std::list<T> list) {
   return sorted;
 }
 
+/// fork-join pool: every worker pushes the tasks it spawns to the front of its
+/// own deque and pops them from there, while idle workers steal from the back
+/// of the others' deques, so thieves take the oldest and therefore largest
+/// tasks. Threads outside the pool spawn into a shared deque. A thread that
+/// waits for a task to be done runs pending tasks meanwhile, and idle workers
+/// sleep on an atomic counter of spawned tasks after a few rounds of spinning
+class thread_pool {
+  using task = std::function<void()>;
+
+  class work_stealing_queue {
+    std::mutex mutex;
+    std::deque<task> tasks;
+
+   public:
+    void push(task t) {
+      std::scoped_lock lock{mutex};
+      tasks.push_front(std::move(t));
+    }
+    bool try_pop(task& t) {
+      std::scoped_lock lock{mutex};
+      if (tasks.empty()) return false;
+      t = std::move(tasks.front());
+      tasks.pop_front();
+      return true;
+    }
+    bool try_steal(task& t) {
+      std::scoped_lock lock{mutex};
+      if (tasks.empty()) return false;
+      t = std::move(tasks.back());
+      tasks.pop_back();
+      return true;
+    }
+  };
+
+  static constexpr int n_spins{64};
+  std::atomic<bool> done{false};
+  std::atomic<int> n_sleepers{0};
+  std::atomic<std::uint32_t> n_spawned{0};
+  work_stealing_queue shared_queue;
+  std::vector<std::unique_ptr<work_stealing_queue>> queues;
+  std::vector<std::thread> threads;
+
+  inline static thread_local thread_pool* local_pool{nullptr};
+  inline static thread_local std::size_t local_index{0};
+
+  bool try_run_pending_task() {
+    task t;
+    bool is_worker{local_pool == this};
+    bool found{is_worker && queues[local_index]->try_pop(t)};
+    if (!found) found = shared_queue.try_steal(t);
+    for (std::size_t i{1}; !found && i <= queues.size(); ++i)
+      found = queues[(local_index + i) % queues.size()]->try_steal(t);
+    if (found) t();
+    return found;
+  }
+
+  void work(std::size_t index) {
+    local_pool = this;
+    local_index = index;
+    for (int i{0}; !done.load();) {
+      if (try_run_pending_task()) {
+        i = 0;
+        continue;
+      }
+      if (++i < n_spins) {
+        std::this_thread::yield();
+        continue;
+      }
+      ++n_sleepers;
+      std::uint32_t observed_spawns{n_spawned.load()};
+      // a spawn that missed the sleeper has already published its task
+      if (!try_run_pending_task() && !done.load())
+        n_spawned.wait(observed_spawns);
+      --n_sleepers;
+      i = 0;
+    }
+  }
+
+ public:
+  /// n_threads counts the thread waiting on the pool, which runs tasks too
+  explicit thread_pool(unsigned n_threads = std::thread::hardware_concurrency())
+      : queues(std::max(1U, n_threads) - 1) {
+    for (auto& queue : queues) queue = std::make_unique<work_stealing_queue>();
+    for (std::size_t i{0}; i < queues.size(); ++i)
+      threads.emplace_back(&thread_pool::work, this, i);
+  }
+  thread_pool(const thread_pool&) = delete;
+  thread_pool& operator=(const thread_pool&) = delete;
+  ~thread_pool() {
+    done.store(true);
+    ++n_spawned;
+    n_spawned.notify_all();
+    for (auto& thread : threads) thread.join();
+  }
+
+  std::size_t size() const { return queues.size() + 1; }
+
+  template <typename F>
+  void spawn(F f) {
+    if (local_pool == this)
+      queues[local_index]->push(std::move(f));
+    else
+      shared_queue.push(std::move(f));
+    ++n_spawned;
+    if (n_sleepers.load() > 0) n_spawned.notify_one();
+  }
+
+  /// runs pending tasks until is_done holds
+  template <typename IsDone>
+  void wait_until(IsDone is_done) {
+    while (!is_done())
+      if (!try_run_pending_task()) std::this_thread::yield();
+  }
+};
+
+/// below this many elements, a range is left to std::sort on a single thread;
+/// ranges are split into about tasks_per_thread of those per thread, for the
+/// thieves to balance partitions of uneven sizes. A lone thread gains nothing
+/// from splitting at all
+std::size_t sequential_cutoff_for(std::size_t distance,
+                                  std::size_t n_threads) {
+  if (n_threads == 1) return distance;
+  constexpr std::size_t tasks_per_thread{16};
+  constexpr std::size_t min_cutoff{1 << 14};
+  return std::max(min_cutoff, distance / (n_threads * tasks_per_thread));
+}
+
+/// the median of the three, moved to the front
+template <typename Iterator, typename Compare>
+void move_median_to_first(Iterator first, Iterator a, Iterator b, Iterator c,
+                          Compare& compare) {
+  if (compare(*a, *b)) {
+    if (compare(*b, *c))
+      std::iter_swap(first, b);
+    else if (compare(*a, *c))
+      std::iter_swap(first, c);
+    else
+      std::iter_swap(first, a);
+  } else if (compare(*a, *c)) {
+    std::iter_swap(first, a);
+  } else if (compare(*b, *c)) {
+    std::iter_swap(first, c);
+  } else {
+    std::iter_swap(first, b);
+  }
+}
+
+/// runs f(0), ..., f(n_blocks - 1) on the pool and waits for all of them,
+/// then rethrows the first exception any of them threw
+template <typename F>
+void for_each_block(thread_pool& pool, std::size_t n_blocks, const F& f) {
+  std::atomic<std::size_t> n_done{0};
+  std::exception_ptr error{nullptr};
+  std::mutex error_mutex;
+  auto run = [&](std::size_t block) {
+    try {
+      f(block);
+    } catch (...) {
+      std::scoped_lock lock{error_mutex};
+      if (!error) error = std::current_exception();
+    }
+    ++n_done;
+  };
+  for (std::size_t block{1}; block < n_blocks; ++block)
+    pool.spawn([&run, block] { run(block); });
+  if (n_blocks > 0) run(0);
+  pool.wait_until([&] { return n_done.load() == n_blocks; });
+  if (error) std::rethrow_exception(error);
+}
+
+/// the first of the n_blocks about even blocks of n elements that block
+/// starts with
+std::size_t block_begin(std::size_t n, std::size_t n_blocks,
+                        std::size_t block) {
+  return n * block / n_blocks;
+}
+
+/// blocks smaller than this are not worth a thread of their own
+constexpr std::size_t min_block_size{1 << 14};
+
+std::size_t n_blocks_for(std::size_t n, std::size_t n_threads) {
+  return std::clamp<std::size_t>(n / min_block_size, 1, n_threads);
+}
+
+/// std::partition on n_blocks blocks at once. Every block partitions itself;
+/// then the elements that belong before the partition point but ended up
+/// after it trade places with those that belong after it but ended up
+/// before, the k-th of the ones with the k-th of the others, with the trades
+/// split evenly between up to as many blocks
+template <typename Iterator, typename Predicate>
+Iterator parallel_partition(thread_pool& pool, Iterator first, Iterator last,
+                            std::size_t n_blocks, const Predicate& pred) {
+  const auto n{static_cast<std::size_t>(last - first)};
+  if (n_blocks <= 1 || n < n_blocks) return std::partition(first, last, pred);
+  std::vector<std::size_t> n_satisfying(n_blocks);
+  for_each_block(pool, n_blocks, [&](std::size_t block) {
+    auto block_first{first + block_begin(n, n_blocks, block)};
+    auto block_last{first + block_begin(n, n_blocks, block + 1)};
+    n_satisfying[block] = static_cast<std::size_t>(
+        std::partition(block_first, block_last, pred) - block_first);
+  });
+  const std::size_t point{std::accumulate(
+      n_satisfying.begin(), n_satisfying.end(), std::size_t{0})};
+  // the elements on the wrong side of point, as runs of positions in order
+  std::vector<std::pair<std::size_t, std::size_t>> to_back;
+  std::vector<std::pair<std::size_t, std::size_t>> to_front;
+  std::size_t n_misplaced{0};
+  for (std::size_t block{0}; block < n_blocks; ++block) {
+    std::size_t begin{block_begin(n, n_blocks, block)};
+    std::size_t mid{begin + n_satisfying[block]};
+    std::size_t end{block_begin(n, n_blocks, block + 1)};
+    if (mid < std::min(end, point)) {
+      to_back.emplace_back(mid, std::min(end, point));
+      n_misplaced += std::min(end, point) - mid;
+    }
+    if (std::max(begin, point) < mid)
+      to_front.emplace_back(std::max(begin, point), mid);
+  }
+  // the position of the k-th misplaced element in runs, moved along in order
+  struct cursor {
+    const std::vector<std::pair<std::size_t, std::size_t>>& runs;
+    std::size_t run{0};
+    std::size_t position{0};
+    cursor(const std::vector<std::pair<std::size_t, std::size_t>>& runs,
+           std::size_t k)
+        : runs{runs} {
+      for (; k >= runs[run].second - runs[run].first; ++run)
+        k -= runs[run].second - runs[run].first;
+      position = runs[run].first + k;
+    }
+    void advance() {
+      if (++position == runs[run].second && run + 1 < runs.size())
+        position = runs[++run].first;
+    }
+  };
+  const std::size_t n_swap_blocks{n_blocks_for(n_misplaced, n_blocks)};
+  for_each_block(pool, n_swap_blocks, [&](std::size_t block) {
+    std::size_t k{block_begin(n_misplaced, n_swap_blocks, block)};
+    std::size_t k_end{block_begin(n_misplaced, n_swap_blocks, block + 1)};
+    if (k == k_end) return;
+    cursor back{to_back, k};
+    cursor front{to_front, k};
+    for (; k < k_end; ++k, back.advance(), front.advance())
+      std::iter_swap(first + back.position, first + front.position);
+  });
+  return first + point;
+}
+
+/// quicksort whose lower partition is left to the thieves. The pivot is the
+/// median of three, or of three medians of three on large ranges, and the
+/// elements equal to it are set apart, so that runs of duplicates end the
+/// recursion. Like introsort, a range that is still being split after
+/// depth_limit levels is sorted by std::sort, which bounds the work at
+/// O(n log n) however unlucky the pivots. The partitions themselves are
+/// split between as many blocks as the n_threads the range has to itself
+/// allow, or else the top levels would leave all but one thread waiting
+template <typename Iterator, typename Compare>
+void p_sort(thread_pool& pool, Iterator first, Iterator last, Compare compare,
+            std::size_t cutoff, int depth_limit, std::size_t n_threads) {
+  auto distance{last - first};
+  if (static_cast<std::size_t>(distance) <= cutoff || depth_limit == 0) {
+    std::sort(first, last, compare);
+    return;
+  }
+  auto mid{first + distance / 2};
+  if (distance >= 1024) {
+    auto step{distance / 8};
+    move_median_to_first(first + 1, first + 1, first + step,
+                         first + 2 * step, compare);
+    move_median_to_first(mid, mid - step, mid, mid + step, compare);
+    move_median_to_first(last - 1, last - 2 * step, last - step, last - 1,
+                         compare);
+    move_median_to_first(first, first + 1, mid, last - 1, compare);
+  } else {
+    move_median_to_first(first, first + 1, mid, last - 1, compare);
+  }
+  const auto pivot{*first};
+  const std::size_t n_blocks{
+      n_blocks_for(static_cast<std::size_t>(distance), n_threads)};
+  auto lower_last{parallel_partition(
+      pool, first, last, n_blocks,
+      [&](const auto& x) { return compare(x, pivot); })};
+  auto higher_first{parallel_partition(
+      pool, lower_last, last, n_blocks,
+      [&](const auto& x) { return !compare(pivot, x); })};
+  // either side gets its share of the threads for its own partitions
+  auto share{[&](auto part_distance) {
+    return std::max<std::size_t>(
+        1, n_threads * static_cast<std::size_t>(part_distance) /
+               static_cast<std::size_t>(distance));
+  }};
+  std::exception_ptr error{nullptr};
+  std::atomic<bool> is_done{false};
+  pool.spawn([&] {
+    try {
+      p_sort(pool, first, lower_last, compare, cutoff, depth_limit - 1,
+             share(lower_last - first));
+    } catch (...) {
+      error = std::current_exception();
+    }
+    is_done.store(true);
+  });
+  std::exception_ptr higher_error{nullptr};
+  try {
+    p_sort(pool, higher_first, last, compare, cutoff, depth_limit - 1,
+           share(last - higher_first));
+  } catch (...) {
+    higher_error = std::current_exception();
+  }
+  // the spawned partition refers to this frame, so it has to finish either way
+  pool.wait_until([&is_done] { return is_done.load(); });
+  if (error) std::rethrow_exception(error);
+  if (higher_error) std::rethrow_exception(higher_error);
+}
+
+template <typename Iterator, typename Compare = std::less<>>
+void p_sort(thread_pool& pool, Iterator first, Iterator last,
+            Compare compare = {}) {
+  const auto distance{static_cast<std::size_t>(last - first)};
+  p_sort(pool, first, last, compare,
+         sequential_cutoff_for(distance, pool.size()),
+         2 * std::bit_width(distance), pool.size());
+}
+
+/// shared by the sorts that are not given a pool
+thread_pool& default_pool() {
+  static thread_pool pool;
+  return pool;
+}
+
+template <typename Iterator, typename Compare = std::less<>>
+void p_sort(Iterator first, Iterator last, Compare compare = {}) {
+  p_sort(default_pool(), first, last, compare);
+}
+
+/// the bits of an integer key, as unsigned and with the sign bit flipped, so
+/// that they order like the key itself
+template <std::integral Key>
+auto radix_of(Key key) {
+  using Radix = std::make_unsigned_t<Key>;
+  constexpr Radix sign_bit{
+      std::is_signed_v<Key>
+          ? static_cast<Radix>(Radix{1}
+                               << (std::numeric_limits<Radix>::digits - 1))
+          : Radix{0}};
+  return static_cast<Radix>(static_cast<Radix>(key) ^ sign_bit);
+}
+
+constexpr int radix_bits{8};
+constexpr std::size_t n_digits{1 << radix_bits};
+
+/// one stable counting pass on the digit at shift. Every block counts its
+/// digits; the counts are then summed up digit by digit and, within a digit,
+/// block by block into where each block moves its elements with that digit.
+/// Returns false without moving anything when all the elements share the
+/// digit, which spares the passes over the high digits of small keys
+template <typename Source, typename Destination, typename Radix>
+bool radix_pass(thread_pool& pool, Source source, Destination destination,
+                std::size_t n, std::size_t n_blocks, int shift,
+                const Radix& radix) {
+  auto digit_of = [&radix, shift](const auto& x) {
+    return static_cast<std::size_t>(radix(x) >> shift) & (n_digits - 1);
+  };
+  std::vector<std::array<std::size_t, n_digits>> offsets(n_blocks);
+  for_each_block(pool, n_blocks, [&](std::size_t block) {
+    auto& counts{offsets[block]};
+    counts.fill(0);
+    for (std::size_t i{block_begin(n, n_blocks, block)},
+         end{block_begin(n, n_blocks, block + 1)};
+         i < end; ++i)
+      ++counts[digit_of(source[i])];
+  });
+  std::size_t offset{0};
+  for (std::size_t digit{0}; digit < n_digits; ++digit) {
+    const std::size_t digit_begin{offset};
+    for (auto& counts : offsets) {
+      std::size_t count{counts[digit]};
+      counts[digit] = offset;
+      offset += count;
+    }
+    if (offset - digit_begin == n) return false;
+  }
+  for_each_block(pool, n_blocks, [&](std::size_t block) {
+    auto& next{offsets[block]};
+    for (std::size_t i{block_begin(n, n_blocks, block)},
+         end{block_begin(n, n_blocks, block + 1)};
+         i < end; ++i) {
+      auto& x{source[i]};
+      destination[next[digit_of(x)]++] = std::move(x);
+    }
+  });
+  return true;
+}
+
+/// stable LSD radix sort on the integer key that key projects the elements
+/// to, a digit of radix_bits at a time, going back and forth between the
+/// range and a buffer of the same size
+template <typename Iterator, typename Projection>
+void radix_sort(thread_pool& pool, Iterator first, Iterator last,
+                Projection key, std::size_t n_blocks) {
+  using T = std::iter_value_t<Iterator>;
+  auto radix = [&key](const T& x) { return radix_of(std::invoke(key, x)); };
+  using Radix = decltype(radix(*first));
+  const auto n{static_cast<std::size_t>(last - first)};
+  if (n < n_digits) {
+    std::stable_sort(first, last, [&radix](const T& a, const T& b) {
+      return radix(a) < radix(b);
+    });
+    return;
+  }
+  std::vector<T> buffer(n);
+  bool is_in_buffer{false};
+  for (int shift{0}; shift < std::numeric_limits<Radix>::digits;
+       shift += radix_bits)
+    if (is_in_buffer ? radix_pass(pool, buffer.begin(), first, n, n_blocks,
+                                  shift, radix)
+                     : radix_pass(pool, first, buffer.begin(), n, n_blocks,
+                                  shift, radix))
+      is_in_buffer = !is_in_buffer;
+  if (is_in_buffer)
+    for_each_block(pool, n_blocks, [&](std::size_t block) {
+      std::move(buffer.begin() + block_begin(n, n_blocks, block),
+                buffer.begin() + block_begin(n, n_blocks, block + 1),
+                first + block_begin(n, n_blocks, block));
+    });
+}
+
+template <typename Iterator, typename Projection = std::identity>
+void radix_sort(thread_pool& pool, Iterator first, Iterator last,
+                Projection key = {}) {
+  radix_sort(pool, first, last, key,
+             n_blocks_for(static_cast<std::size_t>(last - first),
+                          pool.size()));
+}
+
+template <typename Iterator, typename Projection = std::identity>
+void radix_sort(Iterator first, Iterator last, Projection key = {}) {
+  radix_sort(default_pool(), first, last, key);
+}
+
+/// bucket numbers are kept per element, in 16 bits
+constexpr std::size_t max_n_buckets{1 << 16};
+
+/// n_buckets - 1 splitters are picked evenly from a sorted random sample of
+/// oversampling elements per bucket, so that the buckets come out about
+/// even. Every block looks up the buckets of its elements among the
+/// splitters and counts them, the blocks move their elements to their
+/// buckets in a buffer as radix_pass does, and every bucket is then moved
+/// back and sorted by p_sort, which copes with buckets swollen by the
+/// duplicates of a splitter
+template <typename Iterator, typename Compare>
+void sample_sort(thread_pool& pool, Iterator first, Iterator last,
+                 Compare compare, std::size_t n_buckets,
+                 std::size_t n_blocks) {
+  using T = std::iter_value_t<Iterator>;
+  constexpr std::size_t oversampling{32};
+  const auto n{static_cast<std::size_t>(last - first)};
+  n_buckets = std::clamp<std::size_t>(n_buckets, 1, max_n_buckets);
+  if (n_buckets == 1 || n < n_buckets * oversampling) {
+    p_sort(pool, first, last, compare);
+    return;
+  }
+  std::default_random_engine engine{};
+  std::uniform_int_distribution<std::size_t> position{0, n - 1};
+  std::vector<T> sample;
+  sample.reserve(n_buckets * oversampling);
+  for (std::size_t i{0}; i < n_buckets * oversampling; ++i)
+    sample.push_back(first[position(engine)]);
+  std::sort(sample.begin(), sample.end(), compare);
+  std::vector<T> splitters;
+  splitters.reserve(n_buckets - 1);
+  for (std::size_t bucket{1}; bucket < n_buckets; ++bucket)
+    splitters.push_back(std::move(sample[bucket * oversampling]));
+
+  std::vector<std::uint16_t> buckets(n);
+  std::vector<std::vector<std::size_t>> offsets(
+      n_blocks, std::vector<std::size_t>(n_buckets));
+  for_each_block(pool, n_blocks, [&](std::size_t block) {
+    auto& counts{offsets[block]};
+    for (std::size_t i{block_begin(n, n_blocks, block)},
+         end{block_begin(n, n_blocks, block + 1)};
+         i < end; ++i) {
+      auto bucket{std::upper_bound(splitters.begin(), splitters.end(),
+                                   first[i], compare) -
+                  splitters.begin()};
+      buckets[i] = static_cast<std::uint16_t>(bucket);
+      ++counts[bucket];
+    }
+  });
+  std::vector<std::size_t> bucket_begins(n_buckets + 1);
+  std::size_t offset{0};
+  for (std::size_t bucket{0}; bucket < n_buckets; ++bucket) {
+    bucket_begins[bucket] = offset;
+    for (auto& counts : offsets) {
+      std::size_t count{counts[bucket]};
+      counts[bucket] = offset;
+      offset += count;
+    }
+  }
+  bucket_begins[n_buckets] = n;
+
+  std::vector<T> buffer(n);
+  for_each_block(pool, n_blocks, [&](std::size_t block) {
+    auto& next{offsets[block]};
+    for (std::size_t i{block_begin(n, n_blocks, block)},
+         end{block_begin(n, n_blocks, block + 1)};
+         i < end; ++i)
+      buffer[next[buckets[i]]++] = std::move(first[i]);
+  });
+  for_each_block(pool, n_buckets, [&](std::size_t bucket) {
+    auto bucket_first{first + bucket_begins[bucket]};
+    auto bucket_last{first + bucket_begins[bucket + 1]};
+    std::move(buffer.begin() + bucket_begins[bucket],
+              buffer.begin() + bucket_begins[bucket + 1], bucket_first);
+    p_sort(pool, bucket_first, bucket_last, compare);
+  });
+}
+
+/// a lone thread, or a range too small to split, goes to p_sort right away
+template <typename Iterator, typename Compare = std::less<>>
+void sample_sort(thread_pool& pool, Iterator first, Iterator last,
+                 Compare compare = {}) {
+  constexpr std::size_t buckets_per_thread{16};
+  const auto n{static_cast<std::size_t>(last - first)};
+  if (n <= sequential_cutoff_for(n, pool.size())) {
+    p_sort(pool, first, last, compare);
+    return;
+  }
+  sample_sort(pool, first, last, compare, buckets_per_thread * pool.size(),
+              n_blocks_for(n, pool.size()));
+}
+
+template <typename Iterator, typename Compare = std::less<>>
+void sample_sort(Iterator first, Iterator last, Compare compare = {}) {
+  sample_sort(default_pool(), first, last, compare);
+}
+
+template <typename T>
+std::vector<T> random_values(std::size_t n, T max) {
+  std::default_random_engine engine{};
+  std::uniform_int_distribution<T> dist{0, max};
+  std::vector<T> values(n);
+  for (auto& value : values) value = dist(engine);
+  return values;
+}
+
+/// against std::sort, on inputs that trouble naive quicksorts
+void check(thread_pool& pool, std::size_t n, std::size_t cutoff) {
+  std::vector<std::vector<int>> inputs{
+      random_values<int>(n, static_cast<int>(n)), random_values<int>(n, 3),
+      std::vector<int>(n, 7)};
+  std::vector<int> ascending(n);
+  for (std::size_t i{0}; i < n; ++i) ascending[i] = static_cast<int>(i);
+  inputs.push_back(ascending);
+  inputs.emplace_back(ascending.rbegin(), ascending.rend());
+  std::vector<int> organ_pipe(n);
+  for (std::size_t i{0}; i < n; ++i)
+    organ_pipe[i] = static_cast<int>(std::min(i, n - i));
+  inputs.push_back(organ_pipe);
+  for (auto& input : inputs) {
+    auto expected{input};
+    std::sort(expected.begin(), expected.end());
+    p_sort(pool, input.begin(), input.end(), std::less<>{}, cutoff,
+           2 * std::bit_width(n), pool.size());
+    assert(input == expected);
+  }
+
+  // zero depth falls back to std::sort straight away
+  auto input{random_values<int>(n, 100)};
+  auto expected{input};
+  std::sort(expected.begin(), expected.end(), std::greater<>{});
+  p_sort(pool, input.begin(), input.end(), std::greater<>{}, cutoff, 0,
+         pool.size());
+  assert(input == expected);
+}
+
+struct record {
+  std::int32_t key;
+  std::uint32_t position;
+};
+
+bool operator==(const record& a, const record& b) {
+  return a.key == b.key && a.position == b.position;
+}
+
+/// against std::count_if, for predicates that hold for none, some or all of
+/// the elements, which must come out merely reordered
+void check_parallel_partition(thread_pool& pool, std::size_t n,
+                              std::size_t n_blocks) {
+  for (int threshold : {0, 3, 50, 101}) {
+    auto input{random_values<int>(n, 100)};
+    auto expected{input};
+    std::sort(expected.begin(), expected.end());
+    auto pred{[threshold](int x) { return x < threshold; }};
+    auto n_satisfying{std::count_if(input.begin(), input.end(), pred)};
+    auto point{
+        parallel_partition(pool, input.begin(), input.end(), n_blocks, pred)};
+    assert(point - input.begin() == n_satisfying);
+    assert(std::is_partitioned(input.begin(), input.end(), pred));
+    std::sort(input.begin(), input.end());
+    assert(input == expected);
+  }
+}
+
+/// against std::stable_sort, with keys of both signs and all widths, and
+/// with keys that leave the high digits alike
+void check_radix_sort(thread_pool& pool, std::size_t n,
+                      std::size_t n_blocks) {
+  std::vector<record> records(n);
+  auto keys{random_values<std::int32_t>(n, 2'000)};
+  for (std::size_t i{0}; i < n; ++i)
+    records[i] = {keys[i] - 1'000, static_cast<std::uint32_t>(i)};
+  auto expected_records{records};
+  std::stable_sort(
+      expected_records.begin(), expected_records.end(),
+      [](const record& a, const record& b) { return a.key < b.key; });
+  radix_sort(pool, records.begin(), records.end(), &record::key, n_blocks);
+  assert(records == expected_records);
+
+  auto check_values = [&pool, n_blocks](auto values) {
+    auto expected{values};
+    std::sort(expected.begin(), expected.end());
+    radix_sort(pool, values.begin(), values.end(), std::identity{},
+               n_blocks);
+    assert(values == expected);
+  };
+  check_values(random_values<std::uint16_t>(n, 60'000));
+  auto wide{random_values<std::int64_t>(
+      n, std::numeric_limits<std::int64_t>::max())};
+  for (std::size_t i{0}; i < n; i += 3) wide[i] = -wide[i];
+  if (n > 1) wide[0] = std::numeric_limits<std::int64_t>::min();
+  check_values(wide);
+  check_values(random_values<std::int64_t>(n, 100));
+  check_values(std::vector<std::uint8_t>(n, 42));
+}
+
+/// against std::sort, on buckets of all sizes down to empty ones
+void check_sample_sort(thread_pool& pool, std::size_t n,
+                       std::size_t n_buckets, std::size_t n_blocks) {
+  std::vector<std::vector<int>> inputs{
+      random_values<int>(n, std::numeric_limits<int>::max()),
+      random_values<int>(n, 3), std::vector<int>(n, 7)};
+  std::vector<int> ascending(n);
+  for (std::size_t i{0}; i < n; ++i) ascending[i] = static_cast<int>(i);
+  inputs.push_back(ascending);
+  for (auto& input : inputs) {
+    auto expected{input};
+    std::sort(expected.begin(), expected.end(), std::greater<>{});
+    sample_sort(pool, input.begin(), input.end(), std::greater<>{},
+                n_buckets, n_blocks);
+    assert(input == expected);
+  }
+
+  std::vector<std::string> words(n);
+  for (std::size_t i{0}; i < n; ++i) words[i] = std::to_string(i * 7919 % n);
+  auto expected{words};
+  std::sort(expected.begin(), expected.end());
+  sample_sort(pool, words.begin(), words.end(), std::less<>{}, n_buckets,
+              n_blocks);
+  assert(words == expected);
+}
+
+/// best of a few runs, in seconds, each sorting a fresh copy of the input
+template <typename Sort, typename Container, typename Compare = std::less<>>
+double time_sort(Sort sort, const Container& input, Compare compare = {}) {
+  double best{std::numeric_limits<double>::max()};
+  for (int i{0}; i < 3; ++i) {
+    auto copy{input};
+    auto start_time{std::chrono::steady_clock::now()};
+    sort(copy);
+    auto elapsed{std::chrono::steady_clock::now() - start_time};
+    assert(std::is_sorted(copy.begin(), copy.end(), compare));
+    best = std::min(best, std::chrono::duration<double>(elapsed).count());
+  }
+  return best;
+}
+
 int main() {
-  const int n{1000};
-  std::random_device random_device{};
-  std::default_random_engine engine{random_device()};
-  std::uniform_int_distribution dist{0, n};
-  std::list<int> list;
-  for (int i{0}; i < n; ++i) list.push_back(dist(engine));
+  if constexpr (!benchmark) {
+    const int n{1000};
+    std::random_device random_device{};
+    std::default_random_engine engine{random_device()};
+    std::uniform_int_distribution dist{0, n};
+    std::list<int> list;
+    for (int i{0}; i < n; ++i) list.push_back(dist(engine));
+
+    std::list<int> sorted{list};
+    sorted.sort();
+
+    std::list<int> p_sorted{sort(list)};
+
+    assert(sorted == p_sorted);
+
+    thread_pool pool{3};
+    thread_pool lone_pool{1};
+    for (std::size_t cutoff : {1, 16, 1000}) {
+      check(pool, 10'000, cutoff);
+      check(lone_pool, 1'000, cutoff);
+    }
+    check(pool, 0, 1);
+    check(pool, 1, 1);
+
+    std::vector<std::string> words(100'000);
+    for (std::size_t i{0}; i < words.size(); ++i)
+      words[i] = std::to_string(i * 7919 % words.size());
+    auto expected{words};
+    std::sort(expected.begin(), expected.end());
+    p_sort(words.begin(), words.end());
+    assert(words == expected);
+
+    // large enough for the partitions at the top to be split into blocks
+    auto many{random_values<int>(1'000'000, 1'000)};
+    auto many_expected{many};
+    std::sort(many_expected.begin(), many_expected.end());
+    p_sort(pool, many.begin(), many.end());
+    assert(many == many_expected);
+
+    auto values{random_values<std::uint64_t>(10'000'000, 1'000'000'000)};
+    p_sort(values.begin(), values.end());
+    assert(std::is_sorted(values.begin(), values.end()));
+
+    // an exception from a comparison reaches the caller
+    try {
+      p_sort(pool, words.begin(), words.end(),
+             [](const std::string& a, const std::string& b) {
+               if (a == "4242" || b == "4242") throw std::out_of_range{"x"};
+               return a < b;
+             },
+             1'000, 64, pool.size());
+      assert(false);
+    } catch (const std::out_of_range&) {
+    }
+
+    for (auto* p : {&pool, &lone_pool})
+      for (std::size_t n_blocks : {1, 3, 7}) {
+        for (std::size_t n : {0, 1, 2, 255, 256, 257, 10'000}) {
+          check_parallel_partition(*p, n, n_blocks);
+          check_radix_sort(*p, n, n_blocks);
+        }
+        for (std::size_t n_buckets : {2, 5, 64})
+          check_sample_sort(*p, 10'000, n_buckets, n_blocks);
+      }
+    check_sample_sort(pool, 100, 64, 3);
+    values = random_values<std::uint64_t>(10'000'000, 1'000'000'000);
+    auto radix_sorted{values};
+    radix_sort(radix_sorted.begin(), radix_sorted.end());
+    sample_sort(values.begin(), values.end());
+    assert(std::is_sorted(values.begin(), values.end()));
+    assert(values == radix_sorted);
+  }
 
-  std::list<int> sorted{list};
-  sorted.sort();
+  if constexpr (benchmark) {
+    const unsigned max_threads{
+        std::max(1U, std::thread::hardware_concurrency())};
+    for (std::size_t n : {1'000, 10'000, 1'000'000, 100'000'000}) {
+      auto input{random_values<int>(n, std::numeric_limits<int>::max())};
+      double sequential{time_sort(
+          [](auto& v) { std::sort(v.begin(), v.end()); }, input)};
+      std::cout << "std::sort\t" << n << " elements\t1 threads\t"
+                << sequential << " s\n";
+      if (n <= 10'000) {
+        std::list<int> list(input.begin(), input.end());
+        double listed{time_sort(
+            [](auto& l) { l = sort(std::move(l)); }, list)};
+        std::cout << "list_sort\t" << n << " elements\tthread_per_split\t"
+                  << listed << " s\t" << sequential / listed << "x\n";
+      }
+      for (unsigned n_threads{1};; n_threads = std::min(2 * n_threads,
+                                                         max_threads)) {
+        thread_pool pool{n_threads};
+        double pooled{time_sort(
+            [&pool](auto& v) { p_sort(pool, v.begin(), v.end()); }, input)};
+        std::cout << "p_sort\t" << n << " elements\t" << n_threads
+                  << " threads\t" << pooled << " s\t" << sequential / pooled
+                  << "x\n";
+        if (n_threads == max_threads) break;
+      }
+    }
 
-  std::list<int> p_sorted{sort(list)};
+    thread_pool pool{max_threads};
+    std::default_random_engine engine{};
+    std::exponential_distribution<double> exponential{1e-3};
+    for (std::size_t n : {1'000'000, 100'000'000}) {
+      auto uniform{random_values<int>(n, std::numeric_limits<int>::max())};
+      // thousands of distinct keys, the small ones far more common
+      std::vector<int> skewed(n);
+      for (auto& x : skewed) x = static_cast<int>(exponential(engine));
+      std::vector<int> presorted(n);
+      for (std::size_t i{0}; i < n; ++i) presorted[i] = static_cast<int>(i);
+      for (auto [distribution, input] :
+           {std::pair{"uniform", &uniform}, std::pair{"skewed", &skewed},
+            std::pair{"presorted", &presorted}}) {
+        double sequential{time_sort(
+            [](auto& v) { std::sort(v.begin(), v.end()); }, *input)};
+        std::cout << distribution << '\t' << n << " elements\t"
+                  << max_threads << " threads\tstd::sort " << sequential
+                  << " s";
+        auto report = [&](const char* name, auto sort) {
+          double pooled{time_sort(sort, *input)};
+          std::cout << '\t' << name << ' ' << pooled << " s "
+                    << sequential / pooled << 'x';
+        };
+        report("p_sort",
+               [&pool](auto& v) { p_sort(pool, v.begin(), v.end()); });
+        report("sample_sort",
+               [&pool](auto& v) { sample_sort(pool, v.begin(), v.end()); });
+        report("radix_sort",
+               [&pool](auto& v) { radix_sort(pool, v.begin(), v.end()); });
+        std::cout << '\n';
+      }
 
-  assert(sorted == p_sorted);
+      std::vector<record> records(n);
+      for (std::size_t i{0}; i < n; ++i)
+        records[i] = {uniform[i], static_cast<std::uint32_t>(i)};
+      auto by_key = [](const record& a, const record& b) {
+        return a.key < b.key;
+      };
+      double sequential{time_sort(
+          [&by_key](auto& v) { std::stable_sort(v.begin(), v.end(), by_key); },
+          records, by_key)};
+      double radix{time_sort(
+          [&pool](auto& v) {
+            radix_sort(pool, v.begin(), v.end(), &record::key);
+          },
+          records, by_key)};
+      std::cout << "records\t" << n << " elements\t" << max_threads
+                << " threads\tstd::stable_sort " << sequential
+                << " s\tradix_sort " << radix << " s " << sequential / radix
+                << "x\n";
+    }
+  }
 }
@@ -4,27 +4,178 @@
 
 #include <algorithm>
 #include <atomic>
+#include <bit>
 #include <cassert>
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
+#include <iterator>
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <stop_token>
 #include <thread>
+#include <utility>
+#include <vector>
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#include <immintrin.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
 
 const bool dump_records{false};
+#ifdef BENCHMARK
+constexpr bool benchmark{true};
+#else
+constexpr bool benchmark{false};
+#endif
+
+constexpr std::size_t cache_line_size{64};
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+  _mm_pause();
+#endif
+}
+
+/// how threadsafe_queue::wait_and_pop waits for an item
+struct wait_strategy {
+  /// times to poll with a CPU pause before going to sleep
+  int n_spins{0};
+  /// sleep on std::atomic::wait and count sleepers, so that push only
+  /// notifies when someone is actually asleep; otherwise every push
+  /// notifies the condition variable
+  bool count_sleepers{false};
+};
+constexpr wait_strategy spin_then_park{1024, true};
 
 template <typename T>
 class threadsafe_queue {
   std::queue<T> data{};
   mutable std::mutex mutex{};
   std::condition_variable cond{};
+  const wait_strategy strategy{};
+  // mirrors data.size() so that spinning consumers need not take the lock
+  std::atomic<std::size_t> n_items{0};
+  // guarded by mutex
+  bool is_closed{false};
+  int n_sleepers{0};
+  int n_timed_sleepers{0};
+  std::atomic<std::uint32_t> n_wakeups{0};
+
+  [[nodiscard]] bool ready() const { return !data.empty() || is_closed; }
+  void spin() {
+    for (int i{0};
+         i < strategy.n_spins && n_items.load(std::memory_order_relaxed) == 0;
+         ++i)
+      cpu_relax();
+  }
+  void wake_all() {
+    {
+      std::lock_guard lock{mutex};
+      ++n_wakeups;
+    }
+    n_wakeups.notify_all();
+    cond.notify_all();
+  }
+  /// wakes the waiters once a stop is requested. it has to outlive the lock
+  /// of the waiter it is for: a callback blocked on mutex would otherwise keep
+  /// its own destruction, under that lock, waiting forever
+  auto wake_on_stop(const std::stop_token &token) {
+    return std::stop_callback{token, [this] { wake_all(); }};
+  }
+  /// the returned lock is held, and data is empty only if the queue has been
+  /// closed or a stop has been requested; the caller wakes on the stop with
+  /// wake_on_stop
+  std::unique_lock<std::mutex> lock_ready(const std::stop_token &token) {
+    spin();
+    std::unique_lock lock{mutex};
+    if (!strategy.count_sleepers) {
+      cond.wait(lock, [&] { return ready() || token.stop_requested(); });
+      return lock;
+    }
+    while (!ready() && !token.stop_requested()) {
+      ++n_sleepers;
+      std::uint32_t observed_wakeups{n_wakeups.load()};
+      lock.unlock();
+      // returns at once if a push has bumped n_wakeups since the lock was held
+      n_wakeups.wait(observed_wakeups);
+      lock.lock();
+      --n_sleepers;
+    }
+    return lock;
+  }
+  /// std::atomic::wait cannot time out, so timed waits always sleep on the
+  /// condition variable
+  template <typename Clock, typename Duration>
+  std::unique_lock<std::mutex> lock_ready_until(
+      const std::chrono::time_point<Clock, Duration> &deadline) {
+    spin();
+    std::unique_lock lock{mutex};
+    ++n_timed_sleepers;
+    cond.wait_until(lock, deadline, [this] { return ready(); });
+    --n_timed_sleepers;
+    return lock;
+  }
+  T pop_front() {
+    T popped{std::move(data.front())};
+    data.pop();
+    n_items.store(data.size(), std::memory_order_relaxed);
+    return popped;
+  }
+  void notify(std::unique_lock<std::mutex> lock, bool all) {
+    bool has_sleepers{n_sleepers > 0};
+    bool has_timed_sleepers{n_timed_sleepers > 0};
+    lock.unlock();
+    if (!strategy.count_sleepers) {
+      all ? cond.notify_all() : cond.notify_one();
+      return;
+    }
+    if (has_sleepers) {
+      ++n_wakeups;
+      all ? n_wakeups.notify_all() : n_wakeups.notify_one();
+    }
+    if (has_timed_sleepers) all ? cond.notify_all() : cond.notify_one();
+  }
+  /// when max_n covers everything queued, the whole container is swapped
+  /// with the empty spare in O(1) and moved from after unlocking
+  template <typename OutputIt>
+  std::size_t pop_bulk(std::unique_lock<std::mutex> lock, std::queue<T> &spare,
+                       OutputIt out, std::size_t max_n) {
+    if (data.size() <= max_n) {
+      data.swap(spare);
+      n_items.store(0, std::memory_order_relaxed);
+      lock.unlock();
+      std::size_t n_popped{spare.size()};
+      for (; !spare.empty(); spare.pop()) *out++ = std::move(spare.front());
+      return n_popped;
+    }
+    for (std::size_t i{0}; i < max_n; ++i) *out++ = pop_front();
+    return max_n;
+  }
+  bool pop_front_into(T &recipient) {
+    if (data.empty()) return false;
+    recipient = pop_front();
+    return true;
+  }
+  std::unique_ptr<T> pop_front_ptr() {
+    if (data.empty()) return nullptr;
+    return std::make_unique<T>(pop_front());
+  }
 
  public:
   threadsafe_queue() = default;
-  threadsafe_queue(const threadsafe_queue &rhs) {
+  explicit threadsafe_queue(wait_strategy strategy) : strategy{strategy} {}
+  threadsafe_queue(const threadsafe_queue &rhs) : strategy{rhs.strategy} {
     std::lock_guard lock{rhs.mutex};
     data = rhs.data;
+    is_closed = rhs.is_closed;
+    n_items.store(data.size(), std::memory_order_relaxed);
   }
   threadsafe_queue &operator=(const threadsafe_queue &) = delete;
   threadsafe_queue(threadsafe_queue &&) = delete;
@@ -33,39 +184,348 @@ class threadsafe_queue {
     std::lock_guard lock{mutex};
     return data.empty();
   }
-  void push(T item) {
+  bool closed() const {
+    std::lock_guard lock{mutex};
+    return is_closed;
+  }
+  /// wakes every waiting consumer; items already queued can still be popped,
+  /// but once the queue runs empty no pop waits for more
+  void close() {
     {
       std::lock_guard lock{mutex};
-      data.push(std::move(item));
+      is_closed = true;
     }
-    cond.notify_one();
+    wake_all();
+  }
+  void push(T item) {
+    std::unique_lock lock{mutex};
+    data.push(std::move(item));
+    n_items.store(data.size(), std::memory_order_relaxed);
+    notify(std::move(lock), false);
+  }
+  /// pushes [first, last) under a single lock and notifies once
+  template <typename InputIt>
+  void push_bulk(InputIt first, InputIt last) {
+    std::unique_lock lock{mutex};
+    std::size_t n_pushed{0};
+    for (; first != last; ++first, ++n_pushed) data.push(*first);
+    if (n_pushed == 0) return;
+    n_items.store(data.size(), std::memory_order_relaxed);
+    notify(std::move(lock), n_pushed > 1);
   }
   bool try_pop(T &recipient) {
     std::lock_guard lock{mutex};
-    if (data.empty()) return false;
-    recipient = std::move(data.front());
-    data.pop();
-    return true;
+    return pop_front_into(recipient);
   }
   std::unique_ptr<T> try_pop() {
     std::lock_guard lock{mutex};
-    if (data.empty()) return nullptr;
-    auto popped{std::make_unique<T>(std::move(data.front()))};
-    data.pop();
-    return popped;
+    return pop_front_ptr();
+  }
+  /// returns false only if the queue is closed and drained, or token has been
+  /// asked to stop
+  bool wait_and_pop(T &recipient, std::stop_token token = {}) {
+    auto stop_waker{wake_on_stop(token)};
+    auto lock{lock_ready(token)};
+    return pop_front_into(recipient);
+  }
+  std::unique_ptr<T> wait_and_pop(std::stop_token token = {}) {
+    auto stop_waker{wake_on_stop(token)};
+    auto lock{lock_ready(token)};
+    return pop_front_ptr();
+  }
+  /// pops up to max_n items under a single lock. spare is an empty queue the
+  /// caller keeps across calls, so that swapping out everything queued
+  /// recycles its storage instead of allocating a fresh container each time
+  template <typename OutputIt>
+  std::size_t try_pop_bulk(OutputIt out, std::size_t max_n,
+                           std::queue<T> &spare) {
+    return pop_bulk(std::unique_lock{mutex}, spare, out, max_n);
+  }
+  template <typename OutputIt>
+  std::size_t try_pop_bulk(OutputIt out, std::size_t max_n) {
+    std::queue<T> spare;
+    return try_pop_bulk(out, max_n, spare);
+  }
+  /// waits for at least one item, then pops up to max_n items under the same
+  /// lock; returns 0 only if the queue is closed and drained, or token has
+  /// been asked to stop
+  template <typename OutputIt>
+  std::size_t wait_and_pop_bulk(OutputIt out, std::size_t max_n,
+                                std::queue<T> &spare,
+                                std::stop_token token = {}) {
+    auto stop_waker{wake_on_stop(token)};
+    return pop_bulk(lock_ready(token), spare, out, max_n);
+  }
+  template <typename OutputIt>
+  std::size_t wait_and_pop_bulk(OutputIt out, std::size_t max_n,
+                                std::stop_token token = {}) {
+    std::queue<T> spare;
+    return wait_and_pop_bulk(out, max_n, spare, std::move(token));
+  }
+  template <typename Clock, typename Duration>
+  bool wait_and_pop_until(
+      T &recipient, const std::chrono::time_point<Clock, Duration> &deadline) {
+    auto lock{lock_ready_until(deadline)};
+    return pop_front_into(recipient);
+  }
+  template <typename Clock, typename Duration>
+  std::unique_ptr<T> wait_and_pop_until(
+      const std::chrono::time_point<Clock, Duration> &deadline) {
+    auto lock{lock_ready_until(deadline)};
+    return pop_front_ptr();
+  }
+  template <typename Rep, typename Period>
+  bool wait_and_pop_for(T &recipient,
+                        const std::chrono::duration<Rep, Period> &timeout) {
+    return wait_and_pop_until(recipient,
+                              std::chrono::steady_clock::now() + timeout);
+  }
+  template <typename Rep, typename Period>
+  std::unique_ptr<T> wait_and_pop_for(
+      const std::chrono::duration<Rep, Period> &timeout) {
+    return wait_and_pop_until(std::chrono::steady_clock::now() + timeout);
+  }
+};
+
+/// bounded MPMC queue where each cell carries a sequence number telling
+/// which lap of the ring it is ready for, so producers and consumers only
+/// contend on a CAS of their own position counter
+template <typename T>
+class ring_buffer_queue {
+  struct cell {
+    std::atomic<std::size_t> sequence;
+    T data{};
+  };
+  static constexpr int n_spins{256};
+  std::vector<cell> buffer;
+  const std::size_t mask;
+  alignas(cache_line_size) std::atomic<std::size_t> enqueue_pos{0};
+  alignas(cache_line_size) std::atomic<std::size_t> dequeue_pos{0};
+  alignas(cache_line_size) std::atomic<int> n_parked_producers{0};
+  std::atomic<int> n_parked_consumers{0};
+
+  static void wake(cell &c, std::atomic<int> &n_parked) {
+    // pairs with the fence in park, so that either the waker sees the
+    // parked thread or the parked thread sees the new sequence
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (n_parked.load(std::memory_order_relaxed) > 0) c.sequence.notify_all();
+  }
+  /// sleeps until the cell at pos moves past the sequence in which it is
+  /// unusable for the caller
+  void park(std::atomic<std::size_t> &pos, std::size_t blocked_sequence_offset,
+            std::atomic<int> &n_parked) {
+    std::size_t p{pos.load(std::memory_order_relaxed)};
+    cell &c{buffer[p & mask]};
+    ++n_parked;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::size_t blocked_sequence{p + blocked_sequence_offset};
+    if (c.sequence.load(std::memory_order_acquire) == blocked_sequence)
+      c.sequence.wait(blocked_sequence, std::memory_order_acquire);
+    --n_parked;
+  }
+  template <typename U>
+  void push_impl(U &&item) {
+    for (int i{0}; !try_push(std::forward<U>(item)); ++i)
+      if (i < n_spins)
+        cpu_relax();
+      else
+        // a full cell still holds the item of the previous lap
+        park(enqueue_pos, 1 - buffer.size(), n_parked_producers);
+  }
+
+ public:
+  /// capacity is rounded up to a power of two
+  explicit ring_buffer_queue(std::size_t capacity)
+      : buffer(std::bit_ceil(std::max<std::size_t>(capacity, 2))),
+        mask{buffer.size() - 1} {
+    for (std::size_t i{0}; i < buffer.size(); ++i)
+      buffer[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  ring_buffer_queue(const ring_buffer_queue &) = delete;
+  ring_buffer_queue &operator=(const ring_buffer_queue &) = delete;
+  ring_buffer_queue(ring_buffer_queue &&) = delete;
+  ring_buffer_queue &operator=(ring_buffer_queue &&) = delete;
+  [[nodiscard]] std::size_t capacity() const { return buffer.size(); }
+  bool empty() const {
+    return dequeue_pos.load(std::memory_order_acquire) >=
+           enqueue_pos.load(std::memory_order_acquire);
+  }
+  /// item is only moved from if the push succeeds
+  template <typename U>
+  bool try_push(U &&item) {
+    std::size_t pos{enqueue_pos.load(std::memory_order_relaxed)};
+    while (true) {
+      cell &c{buffer[pos & mask]};
+      std::size_t sequence{c.sequence.load(std::memory_order_acquire)};
+      auto diff{static_cast<std::ptrdiff_t>(sequence - pos)};
+      if (diff == 0) {
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          c.data = std::forward<U>(item);
+          c.sequence.store(pos + 1, std::memory_order_release);
+          wake(c, n_parked_consumers);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+  void push(T item) { push_impl(std::move(item)); }
+  bool try_pop(T &recipient) {
+    std::size_t pos{dequeue_pos.load(std::memory_order_relaxed)};
+    while (true) {
+      cell &c{buffer[pos & mask]};
+      std::size_t sequence{c.sequence.load(std::memory_order_acquire)};
+      auto diff{static_cast<std::ptrdiff_t>(sequence - (pos + 1))};
+      if (diff == 0) {
+        if (dequeue_pos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          recipient = std::move(c.data);
+          c.sequence.store(pos + buffer.size(), std::memory_order_release);
+          wake(c, n_parked_producers);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = dequeue_pos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+  std::unique_ptr<T> try_pop() {
+    T item;
+    if (!try_pop(item)) return nullptr;
+    return std::make_unique<T>(std::move(item));
   }
   void wait_and_pop(T &recipient) {
-    std::unique_lock lock{mutex};
-    cond.wait(lock, [this] { return !data.empty(); });
-    recipient = std::move(data.front());
-    data.pop();
+    for (int i{0}; !try_pop(recipient); ++i)
+      if (i < n_spins)
+        cpu_relax();
+      else
+        // an empty cell still waits for the item of the current lap
+        park(dequeue_pos, 0, n_parked_consumers);
   }
   std::unique_ptr<T> wait_and_pop() {
-    std::unique_lock lock{mutex};
-    cond.wait(lock, [this] { return !data.empty(); });
-    auto popped{std::make_unique<T>(std::move(data.front()))};
-    data.pop();
-    return popped;
+    T item;
+    wait_and_pop(item);
+    return std::make_unique<T>(std::move(item));
+  }
+};
+
+/// single-producer single-consumer ring where each side keeps a private copy
+/// of the other side's index and only re-reads the shared one when the copy
+/// says the ring is empty or full
+template <typename T>
+class spsc_queue {
+  static constexpr int n_spins{256};
+  std::vector<T> buffer;
+  const std::size_t mask;
+  const std::size_t commit_batch;
+  // owned by the consumer
+  alignas(cache_line_size) std::atomic<std::size_t> head{0};
+  std::size_t cached_tail{0};
+  // owned by the producer
+  alignas(cache_line_size) std::atomic<std::size_t> tail{0};
+  std::size_t pending_tail{0};
+  std::size_t cached_head{0};
+  alignas(cache_line_size) std::atomic<bool> consumer_parked{false};
+  std::atomic<bool> producer_parked{false};
+
+  static void wake(std::atomic<std::size_t> &index,
+                   std::atomic<bool> &parked) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parked.load(std::memory_order_relaxed)) index.notify_one();
+  }
+  static void park(std::atomic<std::size_t> &index, std::size_t blocked_index,
+                   std::atomic<bool> &parked) {
+    parked.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    index.wait(blocked_index, std::memory_order_acquire);
+    parked.store(false, std::memory_order_relaxed);
+  }
+
+ public:
+  /// capacity is rounded up to a power of two; with commit_batch > 1 pushed
+  /// items are published to the consumer only every commit_batch pushes, or
+  /// on commit()
+  explicit spsc_queue(std::size_t capacity, std::size_t commit_batch = 1)
+      : buffer(std::bit_ceil(std::max<std::size_t>(capacity, 2))),
+        mask{buffer.size() - 1},
+        commit_batch{std::clamp<std::size_t>(commit_batch, 1, buffer.size())} {}
+  spsc_queue(const spsc_queue &) = delete;
+  spsc_queue &operator=(const spsc_queue &) = delete;
+  spsc_queue(spsc_queue &&) = delete;
+  spsc_queue &operator=(spsc_queue &&) = delete;
+  [[nodiscard]] std::size_t capacity() const { return buffer.size(); }
+  bool empty() const {
+    return head.load(std::memory_order_acquire) ==
+           tail.load(std::memory_order_acquire);
+  }
+  /// producer only
+  void commit() {
+    if (pending_tail == tail.load(std::memory_order_relaxed)) return;
+    tail.store(pending_tail, std::memory_order_release);
+    wake(tail, consumer_parked);
+  }
+  /// producer only, item is only moved from if the push succeeds
+  template <typename U>
+  bool try_push(U &&item) {
+    if (pending_tail - cached_head == buffer.size()) {
+      cached_head = head.load(std::memory_order_acquire);
+      if (pending_tail - cached_head == buffer.size()) {
+        // the consumer may be waiting for exactly the items held back
+        commit();
+        return false;
+      }
+    }
+    buffer[pending_tail & mask] = std::forward<U>(item);
+    ++pending_tail;
+    if (pending_tail - tail.load(std::memory_order_relaxed) >= commit_batch)
+      commit();
+    return true;
+  }
+  /// producer only
+  void push(T item) {
+    for (int i{0}; !try_push(std::move(item)); ++i)
+      if (i < n_spins)
+        cpu_relax();
+      else
+        park(head, pending_tail - buffer.size(), producer_parked);
+  }
+  /// consumer only
+  bool try_pop(T &recipient) {
+    std::size_t h{head.load(std::memory_order_relaxed)};
+    if (h == cached_tail) {
+      cached_tail = tail.load(std::memory_order_acquire);
+      if (h == cached_tail) return false;
+    }
+    recipient = std::move(buffer[h & mask]);
+    head.store(h + 1, std::memory_order_release);
+    wake(head, producer_parked);
+    return true;
+  }
+  /// consumer only
+  std::unique_ptr<T> try_pop() {
+    T item;
+    if (!try_pop(item)) return nullptr;
+    return std::make_unique<T>(std::move(item));
+  }
+  /// consumer only
+  void wait_and_pop(T &recipient) {
+    for (int i{0}; !try_pop(recipient); ++i)
+      if (i < n_spins)
+        cpu_relax();
+      else
+        park(tail, head.load(std::memory_order_relaxed), consumer_parked);
+  }
+  /// consumer only
+  std::unique_ptr<T> wait_and_pop() {
+    T item;
+    wait_and_pop(item);
+    return std::make_unique<T>(std::move(item));
   }
 };
 
@@ -81,7 +541,44 @@ std::ostream &operator<<(std::ostream &os, const record &r) {
             << ')';
 }
 
-int main() {
+const int stop_item{-1};
+
+/// queues that can be closed tell their consumers to stop that way, while the
+/// others are fed a stop item per consumer
+template <typename Queue>
+concept closable = requires(Queue &queue) { queue.close(); };
+
+template <typename Queue>
+void stop_consumers(Queue &queue, int n_consumers) {
+  if constexpr (closable<Queue>) {
+    queue.close();
+  } else {
+    for (int i{0}; i < n_consumers; ++i) queue.push(stop_item);
+    if constexpr (requires { queue.commit(); }) queue.commit();
+  }
+}
+
+/// waits for an item; returns false once the consumer is told to stop
+template <typename Queue>
+bool pop_or_stop(Queue &queue, int &item) {
+  if constexpr (closable<Queue>) {
+    return queue.wait_and_pop(item);
+  } else {
+    queue.wait_and_pop(item);
+    return item != stop_item;
+  }
+}
+
+template <typename Queue>
+std::unique_ptr<int> pop_or_stop(Queue &queue) {
+  auto item{queue.wait_and_pop()};
+  if constexpr (!closable<Queue>)
+    if (*item == stop_item) return nullptr;
+  return item;
+}
+
+template <typename Queue>
+void test_schedule(Queue &queue) {
   const int n_threads{
       std::max(2, static_cast<int>(std::thread::hardware_concurrency()))};
   const int n_consumers{n_threads - 1};
@@ -89,8 +586,6 @@ int main() {
   const std::chrono::microseconds time_to_produce{10'000};
   const std::chrono::microseconds time_to_consume{time_to_produce *
                                                   n_consumers};
-  const int stop_item{-1};
-  threadsafe_queue<int> queue;
   std::vector<std::thread> consumers;
   std::vector<std::vector<record>> consumers_records(n_consumers + 1);
   std::atomic<int> n_blocked{0};
@@ -115,18 +610,17 @@ int main() {
         int item;
         while (true) {
           ++n_blocked;
-          queue.wait_and_pop(item);
+          bool popped{pop_or_stop(queue, item)};
           --n_blocked;
-          if (item == stop_item) break;
+          if (!popped) break;
           process(item);
         }
       } else {
-        std::unique_ptr<int> item;
         while (true) {
           ++n_blocked;
-          item = queue.wait_and_pop();
+          auto item{pop_or_stop(queue)};
           --n_blocked;
-          if (*item == stop_item) break;
+          if (!item) break;
           process(*item);
         }
       }
@@ -148,7 +642,7 @@ int main() {
   }
 
   auto producing_end_time{std::chrono::system_clock::now()};
-  for (int i{0}; i < n_consumers; ++i) queue.push(stop_item);
+  stop_consumers(queue, n_consumers);
   for (auto &consumer : consumers) consumer.join();
   auto offset{std::chrono::duration_cast<std::chrono::microseconds>(
       std::chrono::system_clock::now() - producing_end_time)};
@@ -171,3 +665,378 @@ int main() {
     std::cout << "])\n";
   }
 }
+
+template <typename Queue>
+void test_close(Queue &queue) {
+  using namespace std::chrono_literals;
+  {
+    int item;
+    auto b{std::chrono::steady_clock::now()};
+    assert(!queue.wait_and_pop_for(item, 10ms));
+    assert(std::chrono::steady_clock::now() - b >= 10ms);
+    assert(!queue.wait_and_pop_until(std::chrono::steady_clock::now() + 1ms));
+    queue.push(1);
+    assert(queue.wait_and_pop_for(item, 10ms) && item == 1);
+  }
+  {
+    std::jthread consumer{[&](std::stop_token token) {
+      assert(!queue.wait_and_pop(std::move(token)));
+    }};
+    std::this_thread::sleep_for(10ms);
+    consumer.request_stop();
+  }
+  for (int round{0}; round < 1'000; ++round) {
+    // stops requested while consumers return from their waits, which must not
+    // deadlock with a consumer dropping its stop callback
+    std::jthread consumer{[&, round](std::stop_token token) {
+      if (round % 2 == 0) {
+        for (int item; queue.wait_and_pop(item, token);) {
+        }
+      } else {
+        std::vector<int> batch;
+        while (queue.wait_and_pop_bulk(std::back_inserter(batch), 4, token))
+          batch.clear();
+      }
+    }};
+    queue.push(round);
+    consumer.request_stop();
+  }
+  while (queue.try_pop()) {
+  }
+  {
+    const int n_consumers{4};
+    const int n_items{1'000};
+    std::atomic<long long> content{0};
+    std::vector<std::thread> consumers;
+    for (int i{0}; i < n_consumers; ++i)
+      consumers.emplace_back([&, i] {
+        if (i % 2 == 0) {
+          for (int item; queue.wait_and_pop(item);) content -= item;
+        } else {
+          while (auto item{queue.wait_and_pop()}) content -= *item;
+        }
+        assert(!queue.wait_and_pop_for(1h));
+      });
+    for (int item{0}; item < n_items; ++item) {
+      queue.push(item);
+      content += item;
+    }
+    queue.close();
+    for (auto &consumer : consumers) consumer.join();
+    assert(content == 0);
+    assert(queue.closed() && queue.empty());
+  }
+}
+
+/// producers and consumers hand items over as fast as they can
+template <typename Queue>
+std::chrono::nanoseconds stream(Queue &queue, int n_producers,
+                                int n_consumers, int n_items_per_producer) {
+  std::vector<std::thread> producers;
+  std::vector<std::thread> consumers;
+  std::atomic<long long> content{0};
+  const auto start_time{std::chrono::system_clock::now() +
+                        std::chrono::milliseconds(100)};
+  for (int i{0}; i < n_consumers; ++i)
+    consumers.emplace_back([&] {
+      std::this_thread::sleep_until(start_time);
+      long long consumed{0};
+      for (int item{}; pop_or_stop(queue, item);) consumed += item;
+      content -= consumed;
+    });
+  for (int i{0}; i < n_producers; ++i)
+    producers.emplace_back([&] {
+      std::this_thread::sleep_until(start_time);
+      long long produced{0};
+      for (int item{0}; item < n_items_per_producer; ++item) {
+        queue.push(item);
+        produced += item;
+      }
+      content += produced;
+    });
+  for (auto &producer : producers) producer.join();
+  stop_consumers(queue, n_consumers);
+  for (auto &consumer : consumers) consumer.join();
+  auto elapsed{std::chrono::system_clock::now() - start_time};
+  assert(content == 0);
+  assert(queue.empty());
+  return elapsed;
+}
+
+/// a thread that sleeps in a futex or condition variable wait gives up the
+/// CPU voluntarily, so this counts the blocking syscalls that actually slept
+long voluntary_context_switches() {
+#if defined(__unix__) || defined(__APPLE__)
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_nvcsw;
+#else
+  return 0;
+#endif
+}
+
+/// the same hand-over as stream, but producers push and consumers pop
+/// batch_size items per call
+template <typename Queue>
+std::chrono::nanoseconds stream_bulk(Queue &queue, int n_producers,
+                                     int n_consumers, int n_items_per_producer,
+                                     int batch_size) {
+  std::vector<std::thread> producers;
+  std::vector<std::thread> consumers;
+  std::atomic<long long> content{0};
+  const auto start_time{std::chrono::system_clock::now() +
+                        std::chrono::milliseconds(100)};
+  for (int i{0}; i < n_consumers; ++i)
+    consumers.emplace_back([&] {
+      std::this_thread::sleep_until(start_time);
+      std::vector<int> batch;
+      std::queue<int> spare;
+      long long consumed{0};
+      while (queue.wait_and_pop_bulk(std::back_inserter(batch), batch_size,
+                                     spare)) {
+        for (int item : batch) consumed += item;
+        batch.clear();
+      }
+      content -= consumed;
+    });
+  for (int i{0}; i < n_producers; ++i)
+    producers.emplace_back([&] {
+      std::this_thread::sleep_until(start_time);
+      std::vector<int> batch;
+      long long produced{0};
+      for (int item{0}; item < n_items_per_producer; ++item) {
+        batch.push_back(item);
+        produced += item;
+        if (batch.size() == static_cast<std::size_t>(batch_size) ||
+            item + 1 == n_items_per_producer) {
+          queue.push_bulk(batch.begin(), batch.end());
+          batch.clear();
+        }
+      }
+      content += produced;
+    });
+  for (auto &producer : producers) producer.join();
+  queue.close();
+  for (auto &consumer : consumers) consumer.join();
+  auto elapsed{std::chrono::system_clock::now() - start_time};
+  assert(content == 0);
+  assert(queue.empty());
+  return elapsed;
+}
+
+template <typename Queue>
+void report_bulk(const char *name, Queue &queue, int n_producers,
+                 int n_consumers, int n_items_per_producer, int batch_size) {
+  auto elapsed{stream_bulk(queue, n_producers, n_consumers,
+                           n_items_per_producer, batch_size)};
+  std::cout << name << "\tbatch=" << batch_size << '\t' << n_producers
+            << " producers\t" << n_consumers << " consumers\t"
+            << n_producers * n_items_per_producer /
+                   std::chrono::duration<double>(elapsed).count()
+            << " items/s\n";
+}
+
+template <typename Queue>
+void report(const char *name, Queue &queue, int n_producers, int n_consumers,
+            int n_items_per_producer) {
+  long n_switches{voluntary_context_switches()};
+  auto elapsed{
+      stream(queue, n_producers, n_consumers, n_items_per_producer)};
+  n_switches = voluntary_context_switches() - n_switches;
+  std::cout << name << '\t' << n_producers << " producers\t" << n_consumers
+            << " consumers\t"
+            << n_producers * n_items_per_producer /
+                   std::chrono::duration<double>(elapsed).count()
+            << " items/s\t" << n_switches << " context switches\n";
+}
+
+/// time from a push until the consumer has popped the item, with the
+/// producer pacing itself so that items do not pile up in the queue
+template <typename Queue>
+std::vector<std::chrono::nanoseconds> measure_handoff(Queue &queue,
+                                                      int n_items) {
+  using clock = std::chrono::steady_clock;
+  const auto interval{std::chrono::microseconds{2}};
+  std::vector<std::chrono::nanoseconds> latencies;
+  latencies.reserve(n_items);
+  std::thread consumer{[&] {
+    clock::time_point pushed_at;
+    for (int i{0}; i < n_items; ++i) {
+      queue.wait_and_pop(pushed_at);
+      latencies.push_back(clock::now() - pushed_at);
+    }
+  }};
+  for (int i{0}; i < n_items; ++i) {
+    auto now{clock::now()};
+    queue.push(now);
+    if constexpr (requires { queue.commit(); }) queue.commit();
+    while (clock::now() < now + interval) cpu_relax();
+  }
+  consumer.join();
+  std::sort(latencies.begin(), latencies.end());
+  return latencies;
+}
+
+template <typename Queue>
+void report_handoff(const char *name, Queue &queue, int n_items) {
+  auto latencies{measure_handoff(queue, n_items)};
+  std::cout << name << "\tp50 " << latencies[latencies.size() / 2].count()
+            << " ns\tp99 " << latencies[latencies.size() * 99 / 100].count()
+            << " ns\n";
+}
+
+int main() {
+  {
+    threadsafe_queue<int> queue;
+    test_schedule(queue);
+  }
+  {
+    threadsafe_queue<int> queue{spin_then_park};
+    test_schedule(queue);
+  }
+  {
+    threadsafe_queue<int> queue{spin_then_park};
+    stream(queue, 2, 2, 10'000);
+  }
+  {
+    threadsafe_queue<int> queue;
+    test_close(queue);
+  }
+  {
+    threadsafe_queue<int> queue{spin_then_park};
+    test_close(queue);
+  }
+  {
+    threadsafe_queue<int> queue;
+    std::vector<int> items{0, 1, 2, 3, 4};
+    queue.push_bulk(items.begin(), items.end());
+    std::vector<int> popped;
+    assert(queue.try_pop_bulk(std::back_inserter(popped), 2) == 2);
+    assert(queue.wait_and_pop_bulk(std::back_inserter(popped), 8) == 3);
+    assert(popped == items);
+    assert(queue.try_pop_bulk(std::back_inserter(popped), 8) == 0);
+    std::queue<int> spare;
+    for (int round{0}; round < 3; ++round) {
+      queue.push_bulk(items.begin(), items.end());
+      popped.clear();
+      assert(queue.wait_and_pop_bulk(std::back_inserter(popped), 8, spare) ==
+             5);
+      assert(popped == items && spare.empty());
+    }
+  }
+  for (int batch_size : {1, 16}) {
+    threadsafe_queue<int> queue;
+    stream_bulk(queue, 2, 2, 10'000, batch_size);
+  }
+  {
+    threadsafe_queue<int> queue{spin_then_park};
+    stream_bulk(queue, 2, 2, 10'000, 16);
+  }
+  {
+    ring_buffer_queue<int> queue{1024};
+    test_schedule(queue);
+  }
+  {
+    ring_buffer_queue<int> queue{3};
+    assert(queue.capacity() == 4);
+    for (int i{0}; i < 4; ++i) assert(queue.try_push(i));
+    assert(!queue.try_push(4));
+    for (int i{0}, item; i < 4; ++i) {
+      assert(queue.try_pop(item));
+      assert(item == i);
+    }
+    assert(!queue.try_pop());
+    assert(queue.empty());
+  }
+  {
+    // a small ring makes both producers and consumers park
+    ring_buffer_queue<int> queue{4};
+    stream(queue, 2, 2, 10'000);
+  }
+  {
+    spsc_queue<int> queue{4, 3};
+    for (int i{0}; i < 3; ++i) assert(queue.try_push(i));
+    assert(!queue.empty());
+    assert(queue.try_push(3));
+    assert(!queue.try_push(4));
+    for (int i{0}, item; i < 4; ++i) {
+      assert(queue.try_pop(item));
+      assert(item == i);
+    }
+    assert(queue.try_push(4));
+    assert(queue.empty() && !queue.try_pop());
+    queue.commit();
+    assert(*queue.try_pop() == 4);
+  }
+  {
+    spsc_queue<int> queue{4};
+    stream(queue, 1, 1, 10'000);
+  }
+  {
+    spsc_queue<int> queue{64, 16};
+    stream(queue, 1, 1, 10'000);
+  }
+
+  if constexpr (benchmark) {
+    const int n_items_per_producer{1'000'000};
+    const int n_threads{
+        std::max(2, static_cast<int>(std::thread::hardware_concurrency()))};
+    for (int n{1};; n = std::min(n * 2, n_threads / 2)) {
+      {
+        threadsafe_queue<int> queue;
+        report("threadsafe_queue", queue, n, n, n_items_per_producer);
+      }
+      {
+        threadsafe_queue<int> queue{wait_strategy{0, true}};
+        report("threadsafe_queue<count_sleepers>", queue, n, n,
+               n_items_per_producer);
+      }
+      {
+        threadsafe_queue<int> queue{spin_then_park};
+        report("threadsafe_queue<spin_then_park>", queue, n, n,
+               n_items_per_producer);
+      }
+      {
+        ring_buffer_queue<int> queue{1024};
+        report("ring_buffer_queue", queue, n, n, n_items_per_producer);
+      }
+      for (int batch_size : {1, 16, 256}) {
+        {
+          threadsafe_queue<int> queue;
+          report_bulk("threadsafe_queue", queue, n, n, n_items_per_producer,
+                      batch_size);
+        }
+        {
+          threadsafe_queue<int> queue{spin_then_park};
+          report_bulk("threadsafe_queue<spin_then_park>", queue, n, n,
+                      n_items_per_producer, batch_size);
+        }
+      }
+      if (n >= n_threads / 2) break;
+    }
+    {
+      spsc_queue<int> queue{1024};
+      report("spsc_queue", queue, 1, 1, n_items_per_producer);
+    }
+    {
+      spsc_queue<int> queue{1024, 64};
+      report("spsc_queue<commit_batch=64>", queue, 1, 1,
+             n_items_per_producer);
+    }
+
+    using time_point = std::chrono::steady_clock::time_point;
+    const int n_handoffs{100'000};
+    {
+      threadsafe_queue<time_point> queue;
+      report_handoff("threadsafe_queue", queue, n_handoffs);
+    }
+    {
+      ring_buffer_queue<time_point> queue{1024};
+      report_handoff("ring_buffer_queue", queue, n_handoffs);
+    }
+    {
+      spsc_queue<time_point> queue{1024};
+      report_handoff("spsc_queue", queue, n_handoffs);
+    }
+  }
+}
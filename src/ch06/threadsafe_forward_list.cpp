@@ -2,14 +2,42 @@
 // Created by iphelf on 2023-11-07.
 //
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
 #include <latch>
+#include <limits>
 #include <memory>
 #include <mutex>
+#include <new>
 #include <random>
+#include <stdexcept>
+#include <string>
 #include <thread>
 #include <vector>
 
+#ifdef BENCHMARK
+constexpr bool benchmark{true};
+#else
+constexpr bool benchmark{false};
+#endif
+
+std::atomic<long long> n_allocated_bytes{0};
+void *operator new(std::size_t size) {
+  n_allocated_bytes += static_cast<long long>(size);
+  if (void *p{std::malloc(size)}) return p;
+  throw std::bad_alloc{};
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
 template <typename T>
 class threadsafe_forward_list {
   struct Node {
@@ -21,6 +49,14 @@ class threadsafe_forward_list {
   std::unique_ptr<Node> head{std::make_unique<Node>()};
 
  public:
+  threadsafe_forward_list() = default;
+  ~threadsafe_forward_list() {
+    // one node at a time, as destroying the chain recursively would overflow
+    // the stack on long lists
+    for (std::unique_ptr<Node> node{std::move(head->next)}; node;)
+      node = std::move(node->next);
+  }
+
   void push_front(const T &item) {
     std::unique_ptr<Node> new_node{std::make_unique<Node>()};
     new_node->data = std::make_shared<T>(item);
@@ -80,53 +116,661 @@ class threadsafe_forward_list {
   }
 };
 
-int main() {
-  {
-    const int n{10};
-    threadsafe_forward_list<int> list;
-    for (int i{0}; i < n; ++i) list.push_front(i);
+// threads claim their hazard pointers all at once, so the pool grows with the
+// machine to fit four threads per hardware thread
+constexpr std::size_t max_hazard_pointers_per_thread{2};
+const std::size_t max_hazard_pointers{std::max<std::size_t>(
+    256,
+    4 * max_hazard_pointers_per_thread * std::thread::hardware_concurrency())};
+
+struct hazard_pointer {
+  std::atomic<std::thread::id> owner{};
+  std::atomic<void *> pointer{nullptr};
+};
+// never resized, so the atomics stay put
+std::vector<hazard_pointer> hazard_pointers(max_hazard_pointers);
+
+class hazard_pointer_owner {
+  hazard_pointer *hp{nullptr};
+
+ public:
+  hazard_pointer_owner() {
+    for (auto &candidate : hazard_pointers) {
+      std::thread::id no_owner{};
+      if (candidate.owner.compare_exchange_strong(no_owner,
+                                                  std::this_thread::get_id())) {
+        hp = &candidate;
+        return;
+      }
+    }
+    throw std::runtime_error{"no hazard pointers available"};
+  }
+  hazard_pointer_owner(const hazard_pointer_owner &) = delete;
+  hazard_pointer_owner &operator=(const hazard_pointer_owner &) = delete;
+  ~hazard_pointer_owner() {
+    hp->pointer.store(nullptr);
+    hp->owner.store(std::thread::id{});
+  }
+  std::atomic<void *> &get_pointer() { return hp->pointer; }
+};
+
+std::atomic<void *> &get_hazard_pointer_for_current_thread(std::size_t i) {
+  thread_local hazard_pointer_owner owners[max_hazard_pointers_per_thread];
+  return owners[i].get_pointer();
+}
+
+struct retired_node {
+  void *pointer;
+  void (*deleter)(void *);
+};
+
+// nodes retired by threads that exited while the nodes were still hazardous
+struct orphanage {
+  std::mutex mutex;
+  std::vector<retired_node> nodes;
+  ~orphanage() {
+    for (auto &node : nodes) node.deleter(node.pointer);
+  }
+} orphaned_nodes;
+
+class retired_list {
+  std::vector<retired_node> nodes;
+
+ public:
+  retired_list() = default;
+  retired_list(const retired_list &) = delete;
+  retired_list &operator=(const retired_list &) = delete;
+  ~retired_list() {
+    scan();
+    if (nodes.empty()) return;
+    std::scoped_lock lock{orphaned_nodes.mutex};
+    orphaned_nodes.nodes.insert(orphaned_nodes.nodes.end(), nodes.begin(),
+                                nodes.end());
+  }
+  void retire(retired_node node) {
+    nodes.push_back(node);
+    if (nodes.size() >= 2 * max_hazard_pointers) scan();
+  }
+  void scan() {
     {
-      int sum{0};
-      list.for_each([&sum](int item) { sum += item; });
-      assert(sum == n * (n - 1) / 2);
+      std::scoped_lock lock{orphaned_nodes.mutex};
+      nodes.insert(nodes.end(), orphaned_nodes.nodes.begin(),
+                   orphaned_nodes.nodes.end());
+      orphaned_nodes.nodes.clear();
     }
-    for (int i{0}; i < n; ++i) {
-      auto found{list.find_first_if([i](int item) { return item == i; })};
-      assert(found && *found == i);
+    std::vector<void *> hazards;
+    for (auto &hp : hazard_pointers)
+      if (void *p{hp.pointer.load()}) hazards.push_back(p);
+    std::sort(hazards.begin(), hazards.end());
+    std::erase_if(nodes, [&hazards](const retired_node &node) {
+      if (std::binary_search(hazards.begin(), hazards.end(), node.pointer))
+        return false;
+      node.deleter(node.pointer);
+      return true;
+    });
+  }
+};
+
+void retire(retired_node node) {
+  thread_local retired_list retired;
+  retired.retire(node);
+}
+
+template <typename Node>
+void retire(Node *node) {
+  retire({node, [](void *pointer) { delete static_cast<Node *>(pointer); }});
+}
+
+/// Harris-Michael list: a node is removed by first marking its next link,
+/// which freezes the link, and then unlinking the node with a CAS on its
+/// predecessor; traversals unlink the marked nodes they meet, and the unlinked
+/// nodes are reclaimed through hazard pointers
+template <typename T>
+class lock_free_forward_list {
+  struct Node {
+    std::shared_ptr<T> data{nullptr};
+    std::atomic<std::uintptr_t> next{0};
+    // one more than the rank of the node behind it at push time, so ranks
+    // strictly decrease from the head on
+    std::uint64_t rank{0};
+  };
+  static constexpr std::uintptr_t removed_mark{1};
+  // dummy head, which is never marked
+  Node head;
+
+  static Node *as_node(std::uintptr_t link) {
+    return reinterpret_cast<Node *>(link & ~removed_mark);
+  }
+  static std::uintptr_t as_link(Node *node) {
+    return reinterpret_cast<std::uintptr_t>(node);
+  }
+
+  enum class step { advance, remove, stop };
+
+  /// hands the live nodes to visit_node in order, with the node and its
+  /// predecessor protected by hazard pointers. A walk restarts from the head
+  /// when its predecessor gets removed under it, and then passes over the
+  /// ranks it has already visited, so no node is visited twice
+  template <typename VisitNode>
+  void walk(VisitNode visit_node) {
+    std::atomic<void *> &hp_prev{get_hazard_pointer_for_current_thread(0)};
+    std::atomic<void *> &hp_node{get_hazard_pointer_for_current_thread(1)};
+    std::uint64_t next_rank{std::numeric_limits<std::uint64_t>::max()};
+    for (bool restart{true}; restart;) {
+      restart = false;
+      std::atomic<std::uintptr_t> *prev_link{&head.next};
+      std::uintptr_t link{prev_link->load()};
+      for (;;) {
+        if (link & removed_mark) {
+          restart = true;
+          break;
+        }
+        Node *node{as_node(link)};
+        if (!node) break;
+        hp_node.store(node);
+        // still linked after being protected, so not yet retired
+        if (std::uintptr_t current{prev_link->load()}; current != link) {
+          link = current;
+          continue;
+        }
+        std::uintptr_t next{node->next.load()};
+        if (next & removed_mark) {
+          if (!prev_link->compare_exchange_strong(link, next & ~removed_mark))
+            continue;
+          retire(node);
+          link = next & ~removed_mark;
+          continue;
+        }
+        if (node->rank < next_rank) {
+          step s{visit_node(*node)};
+          if (s == step::stop) break;
+          if (s == step::remove) {
+            if (!node->next.compare_exchange_strong(next,
+                                                    next | removed_mark))
+              continue;
+            next_rank = node->rank;
+            if (!prev_link->compare_exchange_strong(link, next)) continue;
+            retire(node);
+            link = next;
+            continue;
+          }
+          next_rank = node->rank;
+        }
+        hp_prev.store(node);
+        prev_link = &node->next;
+        link = next;
+      }
     }
-    list.remove_if([](int item) { return item % 2 != 0; });
-    {
-      int sum{0};
-      list.for_each([&sum](int item) { sum += item; });
-      // 0 2 4 6 8
-      assert(sum == 20);
+    hp_node.store(nullptr);
+    hp_prev.store(nullptr);
+  }
+
+ public:
+  lock_free_forward_list() = default;
+  lock_free_forward_list(const lock_free_forward_list &) = delete;
+  lock_free_forward_list &operator=(const lock_free_forward_list &) = delete;
+  ~lock_free_forward_list() {
+    for (Node *node{as_node(head.next.load())}; node;) {
+      Node *next{as_node(node->next.load())};
+      delete node;
+      node = next;
     }
   }
 
+  void push_front(const T &item) {
+    Node *new_node{new Node{std::make_shared<T>(item)}};
+    std::atomic<void *> &hp{get_hazard_pointer_for_current_thread(0)};
+    std::uintptr_t first{head.next.load()};
+    for (;;) {
+      hp.store(as_node(first));
+      if (std::uintptr_t current{head.next.load()}; current != first) {
+        first = current;
+        continue;
+      }
+      new_node->rank = first ? as_node(first)->rank + 1 : 0;
+      new_node->next.store(first);
+      if (head.next.compare_exchange_weak(first, as_link(new_node))) break;
+    }
+    hp.store(nullptr);
+  }
+
+  template <typename Visit>
+  void for_each(Visit visit) {
+    walk([&visit](Node &node) {
+      visit(*node.data);
+      return step::advance;
+    });
+  }
+
+  template <typename Predicate>
+  std::shared_ptr<T> find_first_if(Predicate predicate) {
+    std::shared_ptr<T> found{nullptr};
+    walk([&](Node &node) {
+      if (!predicate(*node.data)) return step::advance;
+      found = node.data;
+      return step::stop;
+    });
+    return found;
+  }
+
+  template <typename Predicate>
+  void remove_if(Predicate predicate) {
+    walk([&predicate](Node &node) {
+      return predicate(*node.data) ? step::remove : step::advance;
+    });
+  }
+
+  bool empty() {
+    bool found{false};
+    walk([&found](Node &) {
+      found = true;
+      return step::stop;
+    });
+    return !found;
+  }
+};
+
+/// lazy list of unrolled nodes: every node holds up to items_per_node items,
+/// which are written once, before the node size publishes them, so traversals
+/// read them without locks. push_front appends to the first node under its
+/// lock, or links a new one under the lock of the head. remove_if locks a node
+/// and its predecessor only once it has found items to remove in the node,
+/// validates that both are still linked, and then replaces the node with a
+/// compacted copy, or unlinks it if nothing is left. Replaced nodes are marked
+/// and reclaimed through hazard pointers
+template <typename T,
+          std::size_t items_per_node = std::clamp<std::size_t>(192 / sizeof(T),
+                                                               1, 64)>
+class unrolled_forward_list {
+  static_assert(items_per_node <= 64, "removals track items in a mask");
+
+  struct Node {
+    std::mutex mutex;
+    std::atomic<bool> marked{false};
+    std::atomic<Node *> next{nullptr};
+    // one more than the rank of the node behind it when it was linked, kept
+    // by its compacted copies, so ranks strictly decrease from the head on
+    std::uint64_t rank{0};
+    std::atomic<std::uint32_t> size{0};
+    alignas(T) std::byte storage[items_per_node * sizeof(T)];
+
+    Node() = default;
+    Node(const Node &) = delete;
+    Node &operator=(const Node &) = delete;
+    ~Node() {
+      for (std::uint32_t i{0}, n{size.load()}; i < n; ++i)
+        std::destroy_at(&item(i));
+    }
+    // published items are never written again
+    const T &item(std::size_t i) const {
+      return *std::launder(reinterpret_cast<const T *>(storage) + i);
+    }
+    void construct(std::size_t i, const T &value) {
+      new (storage + i * sizeof(T)) T{value};
+    }
+  };
+  // dummy head, which is never marked and never holds items
+  Node head;
+
+  enum class step { advance, relinked, stop, restart };
+
+  /// hands the nodes to visit_node(prev, node) in order, with both protected
+  /// by hazard pointers. relinked means that visit_node has replaced or
+  /// unlinked node, so the walk goes on from prev. A walk restarts from the
+  /// head when its predecessor gets marked under it, or when visit_node asks
+  /// for it, and then passes over the ranks it has already visited
+  template <typename VisitNode>
+  void walk(VisitNode visit_node) {
+    std::atomic<void *> &hp_prev{get_hazard_pointer_for_current_thread(0)};
+    std::atomic<void *> &hp_node{get_hazard_pointer_for_current_thread(1)};
+    std::uint64_t next_rank{std::numeric_limits<std::uint64_t>::max()};
+    for (bool restart{true}; restart;) {
+      restart = false;
+      Node *prev{&head};
+      Node *node{head.next.load()};
+      while (node) {
+        hp_node.store(node);
+        if (Node *current{prev->next.load()}; current != node) {
+          node = current;
+          continue;
+        }
+        if (prev->marked.load()) {
+          restart = true;
+          break;
+        }
+        if (node->rank < next_rank) {
+          step s{visit_node(*prev, *node)};
+          if (s == step::stop) break;
+          if (s == step::restart) {
+            restart = true;
+            break;
+          }
+          next_rank = node->rank;
+          if (s == step::relinked) {
+            node = prev->next.load();
+            continue;
+          }
+        }
+        hp_prev.store(node);
+        prev = node;
+        node = node->next.load();
+      }
+    }
+    hp_node.store(nullptr);
+    hp_prev.store(nullptr);
+  }
+
+ public:
+  unrolled_forward_list() = default;
+  unrolled_forward_list(const unrolled_forward_list &) = delete;
+  unrolled_forward_list &operator=(const unrolled_forward_list &) = delete;
+  ~unrolled_forward_list() {
+    for (Node *node{head.next.load()}; node;) {
+      Node *next{node->next.load()};
+      delete node;
+      node = next;
+    }
+  }
+
+  void push_front(const T &item) {
+    std::atomic<void *> &hp{get_hazard_pointer_for_current_thread(0)};
+    for (;;) {
+      Node *first{head.next.load()};
+      hp.store(first);
+      if (head.next.load() != first) continue;
+      if (first && first->size.load() < items_per_node) {
+        std::scoped_lock lock{first->mutex};
+        std::uint32_t size{first->size.load()};
+        if (first->marked.load() || size == items_per_node) continue;
+        first->construct(size, item);
+        first->size.store(size + 1);
+        break;
+      }
+      std::scoped_lock lock{head.mutex};
+      if (head.next.load() != first) continue;
+      Node *new_node{new Node};
+      new_node->construct(0, item);
+      new_node->size.store(1);
+      new_node->rank = first ? first->rank + 1 : 0;
+      new_node->next.store(first);
+      head.next.store(new_node);
+      break;
+    }
+    hp.store(nullptr);
+  }
+
+  /// visits the items from the most recently pushed one on, like
+  /// threadsafe_forward_list
+  template <typename Visit>
+  void for_each(Visit visit) {
+    walk([&visit](Node &, Node &node) {
+      for (std::uint32_t i{node.size.load()}; i-- > 0;) visit(node.item(i));
+      return step::advance;
+    });
+  }
+
+  /// returns a copy of the item, which stays in place in its node
+  template <typename Predicate>
+  std::shared_ptr<T> find_first_if(Predicate predicate) {
+    std::shared_ptr<T> found{nullptr};
+    walk([&](Node &, Node &node) {
+      for (std::uint32_t i{node.size.load()}; i-- > 0;)
+        if (predicate(node.item(i))) {
+          found = std::make_shared<T>(node.item(i));
+          return step::stop;
+        }
+      return step::advance;
+    });
+    return found;
+  }
+
+  template <typename Predicate>
+  void remove_if(Predicate predicate) {
+    walk([&predicate](Node &prev, Node &node) {
+      std::uint32_t size{node.size.load()};
+      std::uint64_t removed{0};
+      for (std::uint32_t i{0}; i < size; ++i)
+        if (predicate(node.item(i))) removed |= std::uint64_t{1} << i;
+      if (!removed) return step::advance;
+      {
+        std::scoped_lock lock{prev.mutex, node.mutex};
+        if (prev.marked.load() || node.marked.load() ||
+            prev.next.load() != &node)
+          return step::restart;
+        // pushes may have appended to the node since it was scanned
+        for (std::uint32_t n{node.size.load()}; size < n; ++size)
+          if (predicate(node.item(size))) removed |= std::uint64_t{1} << size;
+        Node *replacement{node.next.load()};
+        if (std::popcount(removed) < static_cast<int>(size)) {
+          replacement = new Node;
+          std::uint32_t n_kept{0};
+          for (std::uint32_t i{0}; i < size; ++i)
+            if (!(removed >> i & 1))
+              replacement->construct(n_kept++, node.item(i));
+          replacement->size.store(n_kept);
+          replacement->rank = node.rank;
+          replacement->next.store(node.next.load());
+        }
+        node.marked.store(true);
+        prev.next.store(replacement);
+      }
+      retire(&node);
+      return step::relinked;
+    });
+  }
+
+  bool empty() {
+    bool found{false};
+    walk([&found](Node &, Node &) {
+      found = true;
+      return step::stop;
+    });
+    return !found;
+  }
+};
+
+template <typename List>
+void check() {
+  const int n{10};
+  List list;
+  for (int i{0}; i < n; ++i) list.push_front(i);
+  {
+    int sum{0};
+    list.for_each([&sum](int item) { sum += item; });
+    assert(sum == n * (n - 1) / 2);
+  }
+  for (int i{0}; i < n; ++i) {
+    auto found{list.find_first_if([i](int item) { return item == i; })};
+    assert(found && *found == i);
+  }
+  list.remove_if([](int item) { return item % 2 != 0; });
+  {
+    int sum{0};
+    list.for_each([&sum](int item) { sum += item; });
+    // 0 2 4 6 8
+    assert(sum == 20);
+  }
+}
+
+/// every thread pushes its own items, looks one of them up after each push
+/// and finally removes them all, while an optional extra thread keeps walking
+/// the list with a visitor that spins on every item; returns the seconds the
+/// pushing threads took
+template <typename List>
+double run_workload(int n_items_per_thread, bool slow_visitor) {
+  const int n_threads{static_cast<int>(std::thread::hardware_concurrency())};
+  using clock = std::chrono::steady_clock;
+  List list;
+  std::vector<std::thread> threads;
+  // timed by the threads themselves, which may well be done before the main
+  // thread gets to run again
+  std::vector<clock::time_point> start_times(n_threads), end_times(n_threads);
+  std::latch latch{n_threads + 1};
+  for (int i_thread{0}; i_thread < n_threads; ++i_thread)
+    threads.emplace_back([&, i_thread] {
+      int item_base{i_thread * n_items_per_thread};
+      std::default_random_engine engine{std::random_device{}()};
+      std::uniform_int_distribution dist{0, n_items_per_thread - 1};
+      latch.arrive_and_wait();
+      start_times[i_thread] = clock::now();
+      for (int i{0}; i < n_items_per_thread; ++i) {
+        int new_item{item_base + i};
+        list.push_front(new_item);
+        int existing_item{item_base + dist(engine) % (i + 1)};
+        auto found{list.find_first_if(
+            [existing_item](int item) { return item == existing_item; })};
+        assert(found && *found == existing_item);
+      }
+      list.remove_if(
+          [&](int item) { return item / n_items_per_thread == i_thread; });
+      end_times[i_thread] = clock::now();
+    });
+  std::atomic<bool> done{false};
+  std::thread visitor;
+  if (slow_visitor)
+    visitor = std::thread{[&list, &done] {
+      while (!done)
+        list.for_each([](int item) {
+          for (int i{0}; i < 100; ++i) {
+            volatile int spin{item};
+            (void)spin;
+          }
+        });
+    }};
+  latch.arrive_and_wait();
+  for (auto &thread : threads) thread.join();
+  done = true;
+  if (visitor.joinable()) visitor.join();
+  assert(list.empty());
+  return std::chrono::duration<double>(
+             *std::max_element(end_times.begin(), end_times.end()) -
+             *std::min_element(start_times.begin(), start_times.end()))
+      .count();
+}
+
+template <typename List>
+void report(const char *name, int n_items_per_thread, bool slow_visitor) {
+  const int n_threads{static_cast<int>(std::thread::hardware_concurrency())};
+  double seconds{run_workload<List>(n_items_per_thread, slow_visitor)};
+  std::cout << name << '\t' << n_threads << " threads\t"
+            << (slow_visitor ? "slow visitor\t" : "no visitor\t")
+            << 1.0 * n_threads * n_items_per_thread / seconds
+            << " push+find/s\n";
+}
+
+template <typename List>
+void report_footprint(const char *name, int n_items) {
+  long long bytes_before{n_allocated_bytes};
   {
-    const int n_threads{static_cast<int>(std::thread::hardware_concurrency())};
-    const int n_items_per_thread{1'000};
-    threadsafe_forward_list<int> list;
+    List list;
+    for (int i{0}; i < n_items; ++i) list.push_front(i);
+    std::cout << name << '\t' << n_items << " items\t"
+              << 1.0 * (n_allocated_bytes - bytes_before) / n_items
+              << " bytes/item\n";
+  }
+}
+
+/// threads keep walking a list of n_items, either all the way through with
+/// for_each or up to a random item with find_first_if, for a second
+template <typename List>
+void report_traversal(const char *name, int n_items) {
+  List list;
+  for (int i{0}; i < n_items; ++i) list.push_front(i);
+  const int n_threads{static_cast<int>(std::thread::hardware_concurrency())};
+  for (bool find : {false, true}) {
+    std::atomic<bool> done{false};
+    std::atomic<long long> n_visited{0};
+    std::latch latch{n_threads + 1};
     std::vector<std::thread> threads;
-    std::latch latch{n_threads};
     for (int i_thread{0}; i_thread < n_threads; ++i_thread)
-      threads.emplace_back([&, i_thread] {
-        int item_base{i_thread * n_items_per_thread};
+      threads.emplace_back([&] {
         std::default_random_engine engine{std::random_device{}()};
-        std::uniform_int_distribution dist{0, n_items_per_thread - 1};
+        std::uniform_int_distribution dist{0, n_items - 1};
+        long long n{0};
         latch.arrive_and_wait();
-        for (int i{0}; i < n_items_per_thread; ++i) {
-          int new_item{item_base + i};
-          list.push_front(new_item);
-          int existing_item{item_base + dist(engine) % (i + 1)};
-          auto found{list.find_first_if(
-              [existing_item](int item) { return item == existing_item; })};
-          assert(found && *found == existing_item);
+        while (!done) {
+          if (find) {
+            int target{dist(engine)};
+            auto found{list.find_first_if(
+                [target](int item) { return item == target; })};
+            assert(found && *found == target);
+            // the newest items come first
+            n += n_items - target;
+          } else {
+            long long sum{0};
+            list.for_each([&sum](int item) { sum += item; });
+            assert(sum == 1LL * n_items * (n_items - 1) / 2);
+            n += n_items;
+          }
         }
-        list.remove_if(
-            [&](int item) { return item / n_items_per_thread == i_thread; });
+        n_visited += n;
       });
+    latch.arrive_and_wait();
+    auto start_time{std::chrono::steady_clock::now()};
+    std::this_thread::sleep_for(std::chrono::seconds{1});
+    done = true;
     for (auto &thread : threads) thread.join();
-    assert(list.empty());
+    auto elapsed{std::chrono::steady_clock::now() - start_time};
+    std::cout << name << '\t' << n_items << " items\t" << n_threads
+              << " threads\t" << (find ? "find_first_if\t" : "for_each\t")
+              << n_visited / std::chrono::duration<double>(elapsed).count()
+              << " items/s\n";
+  }
+}
+
+template <typename List>
+void check_single_visits() {
+  // removals that restart a walk never make it visit an item twice
+  List list;
+  const int n{10'000};
+  for (int i{0}; i < n; ++i) list.push_front(i);
+  std::thread remover{
+      [&list] { list.remove_if([](int item) { return item % 3 == 0; }); }};
+  std::vector<int> seen;
+  list.for_each([&seen](int item) { seen.push_back(item); });
+  remover.join();
+  assert(std::adjacent_find(seen.begin(), seen.end(), std::less_equal<>{}) ==
+         seen.end());
+}
+
+int main() {
+  check<threadsafe_forward_list<int>>();
+  check<lock_free_forward_list<int>>();
+  check<unrolled_forward_list<int>>();
+  check<unrolled_forward_list<int, 3>>();
+
+  for (bool slow_visitor : {false, true}) {
+    run_workload<threadsafe_forward_list<int>>(1'000, slow_visitor);
+    run_workload<lock_free_forward_list<int>>(1'000, slow_visitor);
+    run_workload<unrolled_forward_list<int>>(1'000, slow_visitor);
+  }
+
+  check_single_visits<lock_free_forward_list<int>>();
+  check_single_visits<unrolled_forward_list<int>>();
+
+  if constexpr (benchmark) {
+    const int n_items_per_thread{5'000};
+    for (bool slow_visitor : {false, true}) {
+      report<threadsafe_forward_list<int>>("hand_over_hand",
+                                           n_items_per_thread, slow_visitor);
+      report<lock_free_forward_list<int>>("lock_free", n_items_per_thread,
+                                          slow_visitor);
+      report<unrolled_forward_list<int>>("unrolled", n_items_per_thread,
+                                         slow_visitor);
+    }
+
+    for (int n_items : {1'000, 1'000'000}) {
+      report_footprint<threadsafe_forward_list<int>>("hand_over_hand",
+                                                     n_items);
+      report_footprint<lock_free_forward_list<int>>("lock_free", n_items);
+      report_footprint<unrolled_forward_list<int>>("unrolled", n_items);
+    }
+
+    for (int n_items : {1'000, 100'000}) {
+      report_traversal<threadsafe_forward_list<int>>("hand_over_hand",
+                                                     n_items);
+      report_traversal<lock_free_forward_list<int>>("lock_free", n_items);
+      report_traversal<unrolled_forward_list<int>>("unrolled", n_items);
+    }
   }
 }
@@ -3,62 +3,674 @@
 //
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
 #include <iostream>
 #include <memory>
 #include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <stop_token>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
 const bool dump_records{false};
+#ifdef BENCHMARK
+constexpr bool benchmark{true};
+#else
+constexpr bool benchmark{false};
+#endif
 
-template <typename T>
+std::atomic<long long> n_allocations{0};
+std::atomic<long long> n_allocated_bytes{0};
+void *operator new(std::size_t size) {
+  ++n_allocations;
+  n_allocated_bytes += static_cast<long long>(size);
+  if (void *p{std::malloc(size)}) return p;
+  throw std::bad_alloc{};
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  ++n_allocations;
+  n_allocated_bytes += static_cast<long long>(size);
+  std::size_t align{static_cast<std::size_t>(alignment)};
+  if (void *p{std::aligned_alloc(align, (size + align - 1) / align * align)})
+    return p;
+  throw std::bad_alloc{};
+}
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+enum class item_storage {
+  /// items are pushed and popped as std::shared_ptr<T>
+  shared_ptr,
+  /// items live inside the queue nodes and are popped as std::optional<T>,
+  /// saving the separate allocation of each item
+  in_node,
+};
+
+enum class node_allocation { heap, pooled };
+
+template <typename Node>
+class node_heap {
+ public:
+  Node *allocate() { return new Node{}; }
+  void deallocate(Node *node) { delete node; }
+};
+
+/// recycles the nodes of one queue without extra locking: the popping side
+/// collects freed nodes under the head lock and hands them over a batch at a
+/// time, and the pushing side takes everything handed over at once under the
+/// tail lock, so nodes never go back to the allocator of another thread
+template <typename Node>
+class node_pool {
+  static constexpr std::size_t batch_size{64};
+  // guarded by the queue's tail lock
+  Node *allocatable{nullptr};
+  // guarded by the queue's head lock
+  Node *freed{nullptr};
+  Node *freed_last{nullptr};
+  std::size_t n_freed{0};
+  std::atomic<Node *> handed_over{nullptr};
+
+  static void delete_all(Node *node) {
+    for (Node *next; node; node = next) {
+      next = node->next;
+      delete node;
+    }
+  }
+
+ public:
+  node_pool() = default;
+  node_pool(const node_pool &) = delete;
+  node_pool &operator=(const node_pool &) = delete;
+  ~node_pool() {
+    delete_all(allocatable);
+    delete_all(freed);
+    delete_all(handed_over.load());
+  }
+  Node *allocate() {
+    if (!allocatable)
+      allocatable = handed_over.exchange(nullptr, std::memory_order_acquire);
+    if (!allocatable) return new Node{};
+    Node *node{allocatable};
+    allocatable = node->next;
+    node->next = nullptr;
+    return node;
+  }
+  void deallocate(Node *node) {
+    node->next = freed;
+    freed = node;
+    if (!freed_last) freed_last = node;
+    if (++n_freed < batch_size) return;
+    freed_last->next = handed_over.load(std::memory_order_relaxed);
+    while (!handed_over.compare_exchange_weak(freed_last->next, freed,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed))
+      ;
+    freed = freed_last = nullptr;
+    n_freed = 0;
+  }
+};
+
+template <typename T, item_storage storage = item_storage::shared_ptr,
+          node_allocation allocation = node_allocation::heap>
 class threadsafe_linked_queue {
+ public:
+  using item_type = std::conditional_t<storage == item_storage::in_node, T,
+                                       std::shared_ptr<T>>;
+  using popped_type =
+      std::conditional_t<storage == item_storage::in_node, std::optional<T>,
+                         std::shared_ptr<T>>;
+
+ private:
   struct node {
-    std::shared_ptr<T> data{nullptr};
-    std::unique_ptr<node> next{nullptr};
+    popped_type data{};
+    node *next{nullptr};
   };
 
-  std::unique_ptr<node> head{std::make_unique<node>()};
-  node *tail{head.get()};
+  std::conditional_t<allocation == node_allocation::pooled, node_pool<node>,
+                     node_heap<node>>
+      nodes;
+  node *head{nodes.allocate()};
+  node *tail{head};
   std::mutex head_mutex;
   std::mutex tail_mutex;
   std::condition_variable cond;
+  // guarded by head_mutex
+  bool is_closed{false};
 
   node *get_tail() {
     std::scoped_lock lock{tail_mutex};
     return tail;
   }
-  std::shared_ptr<T> pop_head(std::unique_lock<std::mutex> &&lock) {
-    std::unique_ptr<node> popped = std::move(head);
-    head = std::move(popped->next);
-    return popped->data;
+  popped_type pop_head(std::unique_lock<std::mutex> &&lock) {
+    node *popped{head};
+    head = popped->next;
+    popped_type data{std::move(popped->data)};
+    popped->data.reset();
+    nodes.deallocate(popped);
+    return data;
+  }
+  popped_type try_pop_head(std::unique_lock<std::mutex> &&lock) {
+    if (head == get_tail()) return {};
+    return pop_head(std::move(lock));
+  }
+  bool ready() { return is_closed || head != get_tail(); }
+  void wake_all() {
+    // a waiter checks for stop under head_mutex before it sleeps
+    {
+      std::scoped_lock lock{head_mutex};
+    }
+    cond.notify_all();
   }
 
  public:
-  void push(std::shared_ptr<T> item) {
+  threadsafe_linked_queue() = default;
+  threadsafe_linked_queue(const threadsafe_linked_queue &) = delete;
+  threadsafe_linked_queue &operator=(const threadsafe_linked_queue &) = delete;
+  ~threadsafe_linked_queue() {
+    for (node *next; head; head = next) {
+      next = head->next;
+      delete head;
+    }
+  }
+  void push(item_type item) {
     {
       std::scoped_lock lock{tail_mutex};
-      tail->data = item;
-      tail->next = std::make_unique<node>();
-      tail = tail->next.get();
+      tail->data = std::move(item);
+      tail->next = nodes.allocate();
+      tail = tail->next;
     }
     cond.notify_one();
   }
-  std::shared_ptr<T> try_pop() {
-    std::scoped_lock lock{head_mutex};
-    if (head.get() == get_tail()) return nullptr;
-    return pop_head(std::move(lock));
+  popped_type try_pop() {
+    std::unique_lock lock{head_mutex};
+    return try_pop_head(std::move(lock));
   }
-  std::shared_ptr<T> wait_and_pop() {
+  /// returns an empty item only if the queue is closed and drained, or token
+  /// has been asked to stop
+  popped_type wait_and_pop(std::stop_token token = {}) {
+    std::stop_callback wake_on_stop{token, [this] { wake_all(); }};
     std::unique_lock lock{head_mutex};
-    cond.wait(lock, [this] { return head.get() != get_tail(); });
-    return pop_head(std::move(lock));
+    cond.wait(lock, [&] { return ready() || token.stop_requested(); });
+    return try_pop_head(std::move(lock));
+  }
+  template <typename Clock, typename Duration>
+  popped_type wait_and_pop_until(
+      const std::chrono::time_point<Clock, Duration> &deadline) {
+    std::unique_lock lock{head_mutex};
+    cond.wait_until(lock, deadline, [this] { return ready(); });
+    return try_pop_head(std::move(lock));
+  }
+  template <typename Rep, typename Period>
+  popped_type wait_and_pop_for(
+      const std::chrono::duration<Rep, Period> &timeout) {
+    return wait_and_pop_until(std::chrono::steady_clock::now() + timeout);
+  }
+  /// wakes every waiting consumer; items already queued can still be popped,
+  /// but once the queue runs empty no pop waits for more
+  void close() {
+    {
+      std::scoped_lock lock{head_mutex};
+      is_closed = true;
+    }
+    cond.notify_all();
+  }
+  bool closed() {
+    std::scoped_lock lock{head_mutex};
+    return is_closed;
   }
   bool empty() {
     std::scoped_lock lock{head_mutex};
-    return head.get() == get_tail();
+    return head == get_tail();
+  }
+};
+
+// threads claim their hazard pointers all at once, so the pool grows with the
+// machine to fit four threads per hardware thread
+constexpr std::size_t max_hazard_pointers_per_thread{2};
+const std::size_t max_hazard_pointers{std::max<std::size_t>(
+    256,
+    4 * max_hazard_pointers_per_thread * std::thread::hardware_concurrency())};
+
+struct hazard_pointer {
+  std::atomic<std::thread::id> owner{};
+  std::atomic<void *> pointer{nullptr};
+};
+// never resized, so the atomics stay put
+std::vector<hazard_pointer> hazard_pointers(max_hazard_pointers);
+
+class hazard_pointer_owner {
+  hazard_pointer *hp{nullptr};
+
+ public:
+  hazard_pointer_owner() {
+    for (auto &candidate : hazard_pointers) {
+      std::thread::id no_owner{};
+      if (candidate.owner.compare_exchange_strong(no_owner,
+                                                  std::this_thread::get_id())) {
+        hp = &candidate;
+        return;
+      }
+    }
+    throw std::runtime_error{"no hazard pointers available"};
+  }
+  hazard_pointer_owner(const hazard_pointer_owner &) = delete;
+  hazard_pointer_owner &operator=(const hazard_pointer_owner &) = delete;
+  ~hazard_pointer_owner() {
+    hp->pointer.store(nullptr);
+    hp->owner.store(std::thread::id{});
+  }
+  std::atomic<void *> &get_pointer() { return hp->pointer; }
+};
+
+std::atomic<void *> &get_hazard_pointer_for_current_thread(std::size_t i) {
+  thread_local hazard_pointer_owner owners[max_hazard_pointers_per_thread];
+  return owners[i].get_pointer();
+}
+
+/// publishes the pointer loaded from source in hp, re-reading source until the
+/// hazard pointer is known to have been published before anyone could have
+/// unlinked and retired the node
+template <typename Node>
+Node *protect(std::atomic<void *> &hp, const std::atomic<Node *> &source) {
+  Node *p{source.load()};
+  Node *protected_p;
+  do {
+    protected_p = p;
+    hp.store(p);
+    p = source.load();
+  } while (p != protected_p);
+  return p;
+}
+
+struct retired_node {
+  void *pointer;
+  void (*deleter)(void *);
+};
+
+// nodes retired by threads that exited while the nodes were still hazardous
+struct orphanage {
+  std::mutex mutex;
+  std::vector<retired_node> nodes;
+  ~orphanage() {
+    for (auto &node : nodes) node.deleter(node.pointer);
+  }
+} orphaned_nodes;
+
+class retired_list {
+  std::vector<retired_node> nodes;
+
+ public:
+  retired_list() = default;
+  retired_list(const retired_list &) = delete;
+  retired_list &operator=(const retired_list &) = delete;
+  ~retired_list() {
+    scan();
+    if (nodes.empty()) return;
+    std::scoped_lock lock{orphaned_nodes.mutex};
+    orphaned_nodes.nodes.insert(orphaned_nodes.nodes.end(), nodes.begin(),
+                                nodes.end());
+  }
+  void retire(retired_node node) {
+    nodes.push_back(node);
+    if (nodes.size() >= 2 * max_hazard_pointers) scan();
+  }
+  void scan() {
+    {
+      std::scoped_lock lock{orphaned_nodes.mutex};
+      nodes.insert(nodes.end(), orphaned_nodes.nodes.begin(),
+                   orphaned_nodes.nodes.end());
+      orphaned_nodes.nodes.clear();
+    }
+    std::vector<void *> hazards;
+    for (auto &hp : hazard_pointers)
+      if (void *p{hp.pointer.load()}) hazards.push_back(p);
+    std::sort(hazards.begin(), hazards.end());
+    std::erase_if(nodes, [&hazards](const retired_node &node) {
+      if (std::binary_search(hazards.begin(), hazards.end(), node.pointer))
+        return false;
+      node.deleter(node.pointer);
+      return true;
+    });
+  }
+};
+
+void retire(retired_node node) {
+  thread_local retired_list retired;
+  retired.retire(node);
+}
+
+template <typename Node>
+void retire(Node *node) {
+  retire({node, [](void *pointer) { delete static_cast<Node *>(pointer); }});
+}
+
+/// lets the consumers of a lock-free queue sleep on std::atomic::wait, while
+/// producers only pay for a notification when someone is asleep
+class parking_lot {
+  static constexpr int n_spins{64};
+  std::atomic<bool> is_closed{false};
+  std::atomic<int> n_sleepers{0};
+  std::atomic<std::uint32_t> n_wakeups{0};
+
+ public:
+  /// returns an empty item only if the lot is closed and try_pop finds
+  /// nothing left
+  template <typename TryPop>
+  auto wait_and_pop(TryPop try_pop) {
+    for (int i{0};; ++i) {
+      if (auto popped{try_pop()}) return popped;
+      if (is_closed.load()) return try_pop();
+      if (i < n_spins) {
+        std::this_thread::yield();
+        continue;
+      }
+      ++n_sleepers;
+      std::uint32_t observed_wakeups{n_wakeups.load()};
+      // a push that missed the sleeper has already published its item
+      auto popped{try_pop()};
+      if (!popped && !is_closed.load()) n_wakeups.wait(observed_wakeups);
+      --n_sleepers;
+      if (popped) return popped;
+    }
+  }
+  /// to be called after an item has been published
+  void notify_one() {
+    if (n_sleepers.load() == 0) return;
+    ++n_wakeups;
+    n_wakeups.notify_one();
+  }
+  void close() {
+    is_closed.store(true);
+    ++n_wakeups;
+    n_wakeups.notify_all();
+  }
+  bool closed() { return is_closed.load(); }
+};
+
+/// Michael-Scott queue: like threadsafe_linked_queue, head always points to a
+/// dummy node, but the links are swung with CAS instead of under head and tail
+/// locks, and popped nodes are reclaimed through hazard pointers
+template <typename T>
+class lock_free_linked_queue {
+ public:
+  using item_type = T;
+  using popped_type = std::optional<T>;
+
+ private:
+  struct node {
+    popped_type data{};
+    std::atomic<node *> next{nullptr};
+  };
+
+  std::atomic<node *> head{new node};
+  std::atomic<node *> tail{head.load()};
+  parking_lot consumers;
+
+ public:
+  lock_free_linked_queue() = default;
+  lock_free_linked_queue(const lock_free_linked_queue &) = delete;
+  lock_free_linked_queue &operator=(const lock_free_linked_queue &) = delete;
+  ~lock_free_linked_queue() {
+    node *next;
+    for (node *p{head.load()}; p; p = next) {
+      next = p->next.load();
+      delete p;
+    }
+  }
+  void push(item_type item) {
+    node *new_node{new node{std::move(item)}};
+    std::atomic<void *> &hp{get_hazard_pointer_for_current_thread(0)};
+    while (true) {
+      node *old_tail{protect(hp, tail)};
+      node *next{old_tail->next.load()};
+      if (next) {
+        // help a push that has linked its node but not yet swung tail
+        tail.compare_exchange_strong(old_tail, next);
+        continue;
+      }
+      if (old_tail->next.compare_exchange_strong(next, new_node)) {
+        tail.compare_exchange_strong(old_tail, new_node);
+        break;
+      }
+    }
+    hp.store(nullptr);
+    consumers.notify_one();
+  }
+  popped_type try_pop() {
+    std::atomic<void *> &hp_head{get_hazard_pointer_for_current_thread(0)};
+    std::atomic<void *> &hp_next{get_hazard_pointer_for_current_thread(1)};
+    popped_type popped{};
+    while (true) {
+      node *old_head{protect(hp_head, head)};
+      node *next{old_head->next.load()};
+      hp_next.store(next);
+      // old_head still being the head means next has not been unlinked
+      if (head.load() != old_head) continue;
+      if (!next) break;
+      node *old_tail{tail.load()};
+      if (old_head == old_tail) {
+        // never let head pass a lagging tail
+        tail.compare_exchange_strong(old_tail, next);
+        continue;
+      }
+      if (head.compare_exchange_strong(old_head, next)) {
+        // next is the new dummy; only the winner of the CAS touches its data
+        popped = std::move(next->data);
+        next->data.reset();
+        hp_head.store(nullptr);
+        retire(old_head);
+        break;
+      }
+    }
+    hp_head.store(nullptr);
+    hp_next.store(nullptr);
+    return popped;
+  }
+  /// returns an empty item only if the queue is closed and drained
+  popped_type wait_and_pop() {
+    return consumers.wait_and_pop([this] { return try_pop(); });
+  }
+  void close() { consumers.close(); }
+  bool closed() { return consumers.closed(); }
+  bool empty() {
+    std::atomic<void *> &hp{get_hazard_pointer_for_current_thread(0)};
+    bool is_empty{!protect(hp, head)->next.load()};
+    hp.store(nullptr);
+    return is_empty;
+  }
+};
+
+constexpr std::size_t cache_line_size{64};
+
+/// unbounded queue made of fixed-size array segments: pushes and pops claim
+/// slots with a fetch_add on the indices of the tail and head segments, and
+/// only CAS when a segment fills up or runs dry
+template <typename T, std::size_t segment_size = 1024>
+class segmented_array_queue {
+ public:
+  using item_type = T;
+  using popped_type = std::optional<T>;
+
+ private:
+  enum slot_state : std::uint8_t { vacant, filled, abandoned };
+  struct slot {
+    std::atomic<std::uint8_t> state{vacant};
+    std::optional<T> item{};
+  };
+  class segment_pool;
+  struct segment {
+    alignas(cache_line_size) std::atomic<std::size_t> push_index{0};
+    alignas(cache_line_size) std::atomic<std::size_t> pop_index{0};
+    std::atomic<segment *> next{nullptr};
+    std::weak_ptr<segment_pool> pool;
+    slot slots[segment_size];
+  };
+  /// keeps a few drained segments for reuse; each entry is handed over by an
+  /// exchange, so a segment can never be taken twice
+  class segment_pool {
+    static constexpr std::size_t max_pooled{4};
+    std::atomic<segment *> pooled[max_pooled]{};
+
+   public:
+    ~segment_pool() {
+      for (auto &entry : pooled) delete entry.load();
+    }
+    segment *take() {
+      for (auto &entry : pooled)
+        if (entry.load(std::memory_order_relaxed))
+          if (segment *s{entry.exchange(nullptr, std::memory_order_acquire)})
+            return s;
+      return nullptr;
+    }
+    void give_back(segment *s) {
+      s->push_index.store(0, std::memory_order_relaxed);
+      s->pop_index.store(0, std::memory_order_relaxed);
+      s->next.store(nullptr, std::memory_order_relaxed);
+      for (auto &slot : s->slots)
+        slot.state.store(vacant, std::memory_order_relaxed);
+      for (auto &entry : pooled) {
+        segment *empty_entry{nullptr};
+        if (entry.compare_exchange_strong(empty_entry, s,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed))
+          return;
+      }
+      delete s;
+    }
+  };
+
+  std::shared_ptr<segment_pool> pool{std::make_shared<segment_pool>()};
+  std::atomic<segment *> head{make_segment()};
+  std::atomic<segment *> tail{head.load()};
+  parking_lot consumers;
+
+  segment *make_segment() {
+    if (segment *s{pool->take()}) return s;
+    auto *s{new segment};
+    s->pool = pool;
+    return s;
+  }
+  /// both indices keep counting past the end of a full segment
+  static bool drained(segment *s) {
+    return std::min(s->pop_index.load(), segment_size) >=
+               std::min(s->push_index.load(), segment_size) &&
+           !s->next.load();
+  }
+  /// retired segments go back to the pool of their queue, unless the queue
+  /// is gone by the time no hazard pointer refers to them
+  static void recycle(void *pointer) {
+    auto *s{static_cast<segment *>(pointer)};
+    if (auto owner{s->pool.lock()})
+      owner->give_back(s);
+    else
+      delete s;
+  }
+
+ public:
+  segmented_array_queue() = default;
+  segmented_array_queue(const segmented_array_queue &) = delete;
+  segmented_array_queue &operator=(const segmented_array_queue &) = delete;
+  ~segmented_array_queue() {
+    segment *next;
+    for (segment *s{head.load()}; s; s = next) {
+      next = s->next.load();
+      delete s;
+    }
+  }
+  void push(item_type item) {
+    std::atomic<void *> &hp{get_hazard_pointer_for_current_thread(0)};
+    while (true) {
+      segment *old_tail{protect(hp, tail)};
+      std::size_t index{old_tail->push_index.fetch_add(1)};
+      if (index < segment_size) {
+        slot &claimed{old_tail->slots[index]};
+        claimed.item.emplace(std::move(item));
+        std::uint8_t expected{vacant};
+        if (claimed.state.compare_exchange_strong(expected, filled,
+                                                  std::memory_order_release))
+          break;
+        // a pop found the slot still vacant and gave up on it
+        item = std::move(*claimed.item);
+        claimed.item.reset();
+        continue;
+      }
+      if (tail.load() != old_tail) continue;
+      segment *next{old_tail->next.load()};
+      if (next) {
+        tail.compare_exchange_strong(old_tail, next);
+        continue;
+      }
+      segment *new_segment{make_segment()};
+      new_segment->slots[0].item.emplace(std::move(item));
+      new_segment->slots[0].state.store(filled, std::memory_order_relaxed);
+      new_segment->push_index.store(1, std::memory_order_relaxed);
+      if (old_tail->next.compare_exchange_strong(next, new_segment)) {
+        tail.compare_exchange_strong(old_tail, new_segment);
+        break;
+      }
+      // never published, so nobody else can have seen it
+      item = std::move(*new_segment->slots[0].item);
+      new_segment->slots[0].item.reset();
+      pool->give_back(new_segment);
+    }
+    hp.store(nullptr);
+    consumers.notify_one();
+  }
+  popped_type try_pop() {
+    std::atomic<void *> &hp{get_hazard_pointer_for_current_thread(0)};
+    popped_type popped{};
+    while (true) {
+      segment *old_head{protect(hp, head)};
+      if (drained(old_head)) break;
+      std::size_t index{old_head->pop_index.fetch_add(1)};
+      if (index < segment_size) {
+        slot &claimed{old_head->slots[index]};
+        if (claimed.state.exchange(abandoned, std::memory_order_acquire) ==
+            filled) {
+          popped = std::move(claimed.item);
+          claimed.item.reset();
+          break;
+        }
+        // the push that claimed this slot has not filled it yet, and will
+        // retry with another one
+        continue;
+      }
+      segment *next{old_head->next.load()};
+      if (!next) break;
+      // never let head pass a lagging tail
+      segment *old_tail{old_head};
+      tail.compare_exchange_strong(old_tail, next);
+      if (head.compare_exchange_strong(old_head, next)) {
+        hp.store(nullptr);
+        retire({old_head, recycle});
+      }
+    }
+    hp.store(nullptr);
+    return popped;
+  }
+  /// returns an empty item only if the queue is closed and drained
+  popped_type wait_and_pop() {
+    return consumers.wait_and_pop([this] { return try_pop(); });
+  }
+  void close() { consumers.close(); }
+  bool closed() { return consumers.closed(); }
+  bool empty() {
+    std::atomic<void *> &hp{get_hazard_pointer_for_current_thread(0)};
+    bool is_empty{drained(protect(hp, head))};
+    hp.store(nullptr);
+    return is_empty;
   }
 };
 
@@ -74,6 +686,76 @@ std::ostream &operator<<(std::ostream &os, const record &r) {
             << ')';
 }
 
+/// producers and consumers hand items over as fast as they can
+template <typename Queue>
+std::chrono::nanoseconds stream(Queue &queue, int n_producers,
+                                int n_consumers, int n_items_per_producer) {
+  std::vector<std::thread> producers;
+  std::vector<std::thread> consumers;
+  std::atomic<long long> content{0};
+  const auto start_time{std::chrono::system_clock::now() +
+                        std::chrono::milliseconds(100)};
+  for (int i{0}; i < n_consumers; ++i)
+    consumers.emplace_back([&] {
+      std::this_thread::sleep_until(start_time);
+      long long consumed{0};
+      while (auto item{queue.wait_and_pop()}) consumed += *item;
+      content -= consumed;
+    });
+  for (int i{0}; i < n_producers; ++i)
+    producers.emplace_back([&] {
+      std::this_thread::sleep_until(start_time);
+      long long produced{0};
+      for (int item{0}; item < n_items_per_producer; ++item) {
+        if constexpr (std::is_same_v<typename Queue::item_type, int>)
+          queue.push(item);
+        else
+          queue.push(std::make_shared<int>(item));
+        produced += item;
+      }
+      content += produced;
+    });
+  for (auto &producer : producers) producer.join();
+  queue.close();
+  for (auto &consumer : consumers) consumer.join();
+  auto elapsed{std::chrono::system_clock::now() - start_time};
+  assert(content == 0);
+  assert(queue.empty());
+  return elapsed;
+}
+
+template <typename Queue>
+void report(const char *name, int n_producers, int n_consumers,
+            int n_items_per_producer) {
+  Queue queue;
+  long long allocations_before{n_allocations};
+  auto elapsed{
+      stream(queue, n_producers, n_consumers, n_items_per_producer)};
+  double n_items{1.0 * n_producers * n_items_per_producer};
+  std::cout << name << '\t' << n_producers << " producers\t" << n_consumers
+            << " consumers\t"
+            << n_items / std::chrono::duration<double>(elapsed).count()
+            << " items/s\t"
+            << (n_allocations - allocations_before) / n_items
+            << " allocations/item\n";
+}
+
+/// bytes allocated by a queue holding n_items, including its empty state
+template <typename Queue>
+void report_footprint(const char *name, int n_items) {
+  long long bytes_before{n_allocated_bytes};
+  Queue queue;
+  for (int i{0}; i < n_items; ++i) {
+    if constexpr (std::is_same_v<typename Queue::item_type, int>)
+      queue.push(i);
+    else
+      queue.push(std::make_shared<int>(i));
+  }
+  std::cout << name << '\t' << n_items << " items\t"
+            << 1.0 * (n_allocated_bytes - bytes_before) / n_items
+            << " bytes/item\n";
+}
+
 int main() {
   const int n_threads{
       std::max(2, static_cast<int>(std::thread::hardware_concurrency()))};
@@ -82,7 +764,6 @@ int main() {
   const std::chrono::microseconds time_to_produce{10'000};
   const std::chrono::microseconds time_to_consume{time_to_produce *
                                                   n_consumers};
-  const int stop_item{-1};
   threadsafe_linked_queue<int> queue;
   std::vector<std::thread> consumers;
   std::vector<std::vector<record>> consumers_records(n_consumers + 1);
@@ -110,7 +791,7 @@ int main() {
         ++n_blocked;
         item = queue.wait_and_pop();
         --n_blocked;
-        if (*item == stop_item) break;
+        if (!item) break;
         process(*item);
       }
     });
@@ -131,8 +812,7 @@ int main() {
   }
 
   auto producing_end_time{std::chrono::system_clock::now()};
-  for (int i{0}; i < n_consumers; ++i)
-    queue.push(std::make_shared<int>(stop_item));
+  queue.close();
   for (auto &consumer : consumers) consumer.join();
   auto offset{std::chrono::duration_cast<std::chrono::microseconds>(
       std::chrono::system_clock::now() - producing_end_time)};
@@ -154,4 +834,114 @@ int main() {
   }
 
   assert(queue.empty());
+
+  {
+    using namespace std::chrono_literals;
+    threadsafe_linked_queue<int> queue;
+    assert(!queue.wait_and_pop_for(10ms));
+    queue.push(std::make_shared<int>(1));
+    assert(*queue.wait_and_pop_until(std::chrono::steady_clock::now()) == 1);
+    std::jthread consumer{
+        [&](std::stop_token token) { assert(!queue.wait_and_pop(token)); }};
+    std::this_thread::sleep_for(10ms);
+    consumer.request_stop();
+  }
+
+  {
+    threadsafe_linked_queue<int, item_storage::in_node,
+                            node_allocation::pooled>
+        queue;
+    for (int round{0}; round < 3; ++round) {
+      long long allocations_before{n_allocations};
+      for (int i{0}; i < 1'000; ++i) queue.push(i);
+      for (int i{0}; i < 1'000; ++i) assert(*queue.try_pop() == i);
+      assert(!queue.try_pop());
+      // after the first round nodes come back out of the pool, except for
+      // those freed into a batch that has not been handed over yet
+      if (round > 0) assert(n_allocations - allocations_before < 64);
+    }
+  }
+  {
+    threadsafe_linked_queue<int, item_storage::shared_ptr,
+                            node_allocation::pooled>
+        queue;
+    stream(queue, 2, 2, 10'000);
+  }
+  {
+    lock_free_linked_queue<int> queue;
+    assert(queue.empty() && !queue.try_pop());
+    for (int i{0}; i < 10; ++i) queue.push(i);
+    assert(!queue.empty());
+    for (int i{0}; i < 10; ++i) assert(*queue.wait_and_pop() == i);
+    assert(queue.empty());
+    stream(queue, 2, 2, 10'000);
+  }
+  {
+    lock_free_linked_queue<int> queue;
+    stream(queue, 1, 4, 10'000);
+  }
+  {
+    segmented_array_queue<int, 4> queue;
+    assert(queue.empty() && !queue.try_pop());
+    for (int round{0}; round < 3; ++round) {
+      for (int i{0}; i < 10; ++i) queue.push(i);
+      assert(!queue.empty());
+      for (int i{0}; i < 10; ++i) assert(*queue.wait_and_pop() == i);
+      assert(queue.empty() && !queue.try_pop());
+    }
+    stream(queue, 2, 2, 10'000);
+  }
+  {
+    segmented_array_queue<int, 16> queue;
+    stream(queue, 4, 1, 10'000);
+  }
+
+  if constexpr (benchmark) {
+    const int n_items_per_producer{1'000'000};
+    const int n_threads{
+        std::max(2, static_cast<int>(std::thread::hardware_concurrency()))};
+    for (int n{1};; n = std::min(n * 2, n_threads / 2)) {
+      report<threadsafe_linked_queue<int>>("shared_ptr/heap", n, n,
+                                           n_items_per_producer);
+      report<threadsafe_linked_queue<int, item_storage::shared_ptr,
+                                     node_allocation::pooled>>(
+          "shared_ptr/pooled", n, n, n_items_per_producer);
+      report<threadsafe_linked_queue<int, item_storage::in_node>>(
+          "in_node/heap", n, n, n_items_per_producer);
+      report<threadsafe_linked_queue<int, item_storage::in_node,
+                                     node_allocation::pooled>>(
+          "in_node/pooled", n, n, n_items_per_producer);
+      if (n >= n_threads / 2) break;
+    }
+
+    for (int n_items : {1'000, 1'000'000}) {
+      report_footprint<threadsafe_linked_queue<int>>("shared_ptr/heap",
+                                                     n_items);
+      report_footprint<threadsafe_linked_queue<int, item_storage::in_node>>(
+          "in_node/heap", n_items);
+      report_footprint<lock_free_linked_queue<int>>("lock_free", n_items);
+      report_footprint<segmented_array_queue<int>>("segmented_array",
+                                                   n_items);
+    }
+
+    const int n_contended_items_per_producer{200'000};
+    for (int n_producers{1};;
+         n_producers = std::min(n_producers * 2, n_threads)) {
+      for (int n_consumers{1};;
+           n_consumers = std::min(n_consumers * 2, n_threads)) {
+        report<threadsafe_linked_queue<int, item_storage::in_node,
+                                       node_allocation::pooled>>(
+            "two_lock", n_producers, n_consumers,
+            n_contended_items_per_producer);
+        report<lock_free_linked_queue<int>>("lock_free", n_producers,
+                                            n_consumers,
+                                            n_contended_items_per_producer);
+        report<segmented_array_queue<int>>("segmented_array", n_producers,
+                                           n_consumers,
+                                           n_contended_items_per_producer);
+        if (n_consumers == n_threads) break;
+      }
+      if (n_producers == n_threads) break;
+    }
+  }
 }
@@ -2,26 +2,110 @@
 // Created by iphelf on 2023-11-07.
 //
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
+#include <cstdlib>
 #include <functional>
+#include <future>
 #include <iostream>
 #include <latch>
+#include <limits>
 #include <list>
 #include <map>
+#include <optional>
 #include <mutex>
+#include <new>
+#include <numeric>
 #include <random>
 #include <shared_mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+#ifdef BENCHMARK
+constexpr bool benchmark{true};
+#else
+constexpr bool benchmark{false};
+#endif
+
+// counts the allocations of everything but the over-aligned slot arrays. gcc
+// pairs the new expressions it inlines these into with the free() below and
+// takes it for a mismatch, though both sides are replaced together
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+std::atomic<long long> n_allocations{0};
+void *operator new(std::size_t size) {
+  ++n_allocations;
+  if (void *p{std::malloc(size)}) return p;
+  throw std::bad_alloc{};
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+constexpr std::size_t cache_line_size{64};
+
+inline void prefetch(const void *address) {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+  _mm_prefetch(static_cast<const char *>(address), _MM_HINT_T0);
+#elif defined(__GNUC__)
+  __builtin_prefetch(address);
+#endif
+}
 
 template <typename F, typename T>
 concept HashFor = std::regular_invocable<F, T> && requires(F f, T t) {
   { std::invoke(f, t) } -> std::convertible_to<std::size_t>;
 };
 
+/// undoes the mixing in threadsafe_lookup_table, so that all keys fall into
+/// its first shard, each at a home group of its own
+struct first_shard_hash {
+  std::size_t operator()(int key) const {
+    std::uint64_t h{static_cast<std::uint32_t>(key) * 0x9e3779b9ULL &
+                    0xffffffff};
+    h ^= h >> 31 ^ h >> 62;
+    h *= 0x319642b2d24d8ec3;
+    h ^= h >> 27 ^ h >> 54;
+    h *= 0x96de1b173f119089;
+    h ^= h >> 30 ^ h >> 60;
+    return h;
+  }
+};
+
+/// hashes std::string and std::string_view alike, so that tables keyed by
+/// std::string can be searched with either
+struct string_hash {
+  using is_transparent = void;
+  std::size_t operator()(std::string_view s) const {
+    return std::hash<std::string_view>{}(s);
+  }
+};
+
+/// the original table, kept as the baseline for the benchmark
 template <typename Key, typename Value, typename Hash = std::hash<Key>>
   requires HashFor<Hash, Key>
-class threadsafe_lookup_table {
+class list_lookup_table {
   struct Bucket {
     using Entry = std::pair<Key, Value>;
     std::list<Entry> data;
@@ -55,7 +139,7 @@ class threadsafe_lookup_table {
   }
 
  public:
-  explicit threadsafe_lookup_table(std::size_t capacity) : buckets(capacity) {}
+  explicit list_lookup_table(std::size_t capacity) : buckets(capacity) {}
   bool try_get(const Key &key, Value &value) const {
     const Bucket &bucket{get_bucket(key)};
     std::shared_lock lock{bucket.mutex};
@@ -89,6 +173,1323 @@ class threadsafe_lookup_table {
   }
 };
 
+// threads claim their hazard pointers all at once, so the pool grows with the
+// machine to fit four threads per hardware thread
+constexpr std::size_t max_hazard_pointers_per_thread{3};
+const std::size_t max_hazard_pointers{std::max<std::size_t>(
+    256,
+    4 * max_hazard_pointers_per_thread * std::thread::hardware_concurrency())};
+
+struct hazard_pointer {
+  std::atomic<std::thread::id> owner{};
+  std::atomic<void *> pointer{nullptr};
+};
+// never resized, so the atomics stay put
+std::vector<hazard_pointer> hazard_pointers(max_hazard_pointers);
+
+class hazard_pointer_owner {
+  hazard_pointer *hp{nullptr};
+
+ public:
+  hazard_pointer_owner() {
+    for (auto &candidate : hazard_pointers) {
+      std::thread::id no_owner{};
+      if (candidate.owner.compare_exchange_strong(no_owner,
+                                                  std::this_thread::get_id())) {
+        hp = &candidate;
+        return;
+      }
+    }
+    throw std::runtime_error{"no hazard pointers available"};
+  }
+  hazard_pointer_owner(const hazard_pointer_owner &) = delete;
+  hazard_pointer_owner &operator=(const hazard_pointer_owner &) = delete;
+  ~hazard_pointer_owner() {
+    hp->pointer.store(nullptr);
+    hp->owner.store(std::thread::id{});
+  }
+  std::atomic<void *> &get_pointer() { return hp->pointer; }
+};
+
+std::atomic<void *> &get_hazard_pointer_for_current_thread(std::size_t i) {
+  thread_local hazard_pointer_owner owners[max_hazard_pointers_per_thread];
+  return owners[i].get_pointer();
+}
+
+/// publishes the pointer loaded from source in hp, re-reading source until the
+/// hazard pointer is known to have been published before anyone could have
+/// replaced and retired the object
+template <typename Node>
+Node *protect(std::atomic<void *> &hp, const std::atomic<Node *> &source) {
+  Node *p{source.load()};
+  Node *protected_p;
+  do {
+    protected_p = p;
+    hp.store(p);
+    p = source.load();
+  } while (p != protected_p);
+  return p;
+}
+
+struct retired_node {
+  void *pointer;
+  void (*deleter)(void *);
+};
+
+// nodes retired by threads that exited while the nodes were still hazardous
+struct orphanage {
+  std::mutex mutex;
+  std::vector<retired_node> nodes;
+  ~orphanage() {
+    for (auto &node : nodes) node.deleter(node.pointer);
+  }
+} orphaned_nodes;
+
+class retired_list {
+  std::vector<retired_node> nodes;
+
+ public:
+  retired_list() = default;
+  retired_list(const retired_list &) = delete;
+  retired_list &operator=(const retired_list &) = delete;
+  ~retired_list() {
+    scan();
+    if (nodes.empty()) return;
+    std::scoped_lock lock{orphaned_nodes.mutex};
+    orphaned_nodes.nodes.insert(orphaned_nodes.nodes.end(), nodes.begin(),
+                                nodes.end());
+  }
+  /// a scan walks the whole pool, so it waits until twice as many nodes as
+  /// there are hazard pointers have piled up, at least half of which it frees
+  void retire(retired_node node) {
+    nodes.push_back(node);
+    if (nodes.size() >= 2 * max_hazard_pointers) scan();
+  }
+  void scan() {
+    {
+      std::scoped_lock lock{orphaned_nodes.mutex};
+      nodes.insert(nodes.end(), orphaned_nodes.nodes.begin(),
+                   orphaned_nodes.nodes.end());
+      orphaned_nodes.nodes.clear();
+    }
+    std::vector<void *> hazards;
+    for (auto &hp : hazard_pointers)
+      if (void *p{hp.pointer.load()}) hazards.push_back(p);
+    std::sort(hazards.begin(), hazards.end());
+    std::erase_if(nodes, [&hazards](const retired_node &node) {
+      if (std::binary_search(hazards.begin(), hazards.end(), node.pointer))
+        return false;
+      node.deleter(node.pointer);
+      return true;
+    });
+  }
+};
+
+template <typename Node>
+void retire(Node *node) {
+  thread_local retired_list retired;
+  retired.retire(
+      {node, [](void *pointer) { delete static_cast<Node *>(pointer); }});
+}
+
+template <typename T>
+constexpr bool is_lock_free_atomic() {
+  if constexpr (std::is_trivially_copyable_v<T>)
+    return std::atomic<T>::is_always_lock_free;
+  else
+    return false;
+}
+
+/// when a shard of threadsafe_lookup_table outgrows its slot array
+struct resize_policy {
+  /// load (filled and erased slots) above which a shard starts migrating
+  double max_load_factor{0.75};
+  /// capacity of the new slot array relative to the live entries, in units of
+  /// what max_load_factor would allow
+  double growth_factor{2.0};
+  /// groups migrated by each write to a shard while a migration is running
+  std::size_t groups_per_step{4};
+};
+
+enum class snapshot_mode { blocking, copy_on_write };
+
+/// open addressing over cache-line-sized groups of slots, probed linearly.
+/// writers lock the shard a key hashes to. when both key and value fit in a
+/// lock-free atomic, readers take no lock at all and instead validate what
+/// they read against the version (a seqlock) of each group they probe.
+/// a growing shard migrates to a bigger slot array a few groups per write, and
+/// meanwhile readers look in the old array first and then in the new one
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+  requires HashFor<Hash, Key>
+class threadsafe_lookup_table {
+  static constexpr bool optimistic_reads{is_lock_free_atomic<Key>() &&
+                                         is_lock_free_atomic<Value>()};
+  static constexpr std::size_t max_shards{256};
+  /// besides Key itself, a transparent Hash lets anything it hashes alike and
+  /// that compares equal to keys look them up, without building a Key
+  template <typename K>
+  static constexpr bool is_transparent_key{
+      requires { typename Hash::is_transparent; } &&
+      !std::is_same_v<std::remove_cvref_t<K>, Key> && HashFor<Hash, K> &&
+      std::equality_comparable_with<Key, K>};
+
+  template <typename T>
+  using cell = std::conditional_t<optimistic_reads, std::atomic<T>, T>;
+  template <typename T>
+  static T load(const std::atomic<T> &cell) {
+    return cell.load(std::memory_order_relaxed);
+  }
+  template <typename T>
+  static const T &load(const T &cell) {
+    return cell;
+  }
+  template <typename T, typename U>
+  static void store(std::atomic<T> &cell, U &&value) {
+    cell.store(std::forward<U>(value), std::memory_order_relaxed);
+  }
+  template <typename T, typename U>
+  static void store(T &cell, U &&value) {
+    cell = std::forward<U>(value);
+  }
+  /// readers without locks may still be reading the source, so only locked
+  /// readers let it be moved from
+  template <typename T>
+  static T take(std::atomic<T> &cell) {
+    return cell.load(std::memory_order_relaxed);
+  }
+  template <typename T>
+  static T &&take(T &cell) {
+    return std::move(cell);
+  }
+
+  // erased slots stay erased until the shard migrates, so that a key never
+  // moves within an array while a reader is probing for it
+  enum class slot_state : std::uint8_t { empty, filled, erased };
+  struct slot {
+    std::atomic<slot_state> state{slot_state::empty};
+    cell<Key> key{};
+    cell<Value> value{};
+  };
+  static constexpr std::size_t slots_per_group{std::max<std::size_t>(
+      1, (cache_line_size - sizeof(std::atomic<std::uint32_t>)) /
+             sizeof(slot))};
+  struct alignas(cache_line_size) group {
+    /// odd while a writer is modifying the group
+    std::atomic<std::uint32_t> version{0};
+    slot slots[slots_per_group];
+  };
+  struct slot_array {
+    std::vector<group> groups;
+    explicit slot_array(std::size_t n_groups) : groups(n_groups) {}
+    [[nodiscard]] std::size_t capacity() const {
+      return groups.size() * slots_per_group;
+    }
+  };
+  struct alignas(cache_line_size) shard {
+    mutable std::shared_mutex mutex;
+    std::atomic<slot_array *> slots{nullptr};
+    /// where slots is being migrated to, if anywhere
+    std::atomic<slot_array *> next{nullptr};
+    // guarded by mutex
+    std::size_t n_filled{0};
+    std::size_t n_used{0};  // filled or erased slots of the array written to
+    std::size_t n_migrated{0};  // groups of slots already moved to next
+    /// where the next write has to copy the content to for a snapshot first
+    mutable std::vector<std::pair<Key, Value>> *pending_copy{nullptr};
+  };
+  resize_policy policy;
+  std::vector<shard> shards;
+  /// one copy-on-write snapshot at a time
+  mutable std::mutex snapshot_mutex;
+  Hash hasher;
+
+  /// std::hash of integers is the identity, so the bits are mixed before they
+  /// pick both a shard and a home group
+  template <typename K>
+  [[nodiscard]] std::uint64_t hash(const K &key) const {
+    std::uint64_t h{hasher(key)};
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111eb;
+    return h ^ (h >> 31);
+  }
+  // the high bits pick the shard and the low ones the home group, both scaled
+  // by a multiplication rather than reduced by a division
+  [[nodiscard]] std::size_t shard_index(std::uint64_t h) const {
+    return static_cast<std::size_t>((h >> 40) * shards.size() >> 24);
+  }
+  static std::size_t home_group(std::uint64_t h, std::size_t n_groups) {
+    return static_cast<std::size_t>((h & 0xffffffff) * n_groups >> 32);
+  }
+  [[nodiscard]] const shard &get_shard(std::uint64_t h) const {
+    return shards[shard_index(h)];
+  }
+  shard &get_shard(std::uint64_t h) { return shards[shard_index(h)]; }
+  [[nodiscard]] std::size_t groups_for(std::size_t n_entries) const {
+    return std::max<std::size_t>(
+        1, static_cast<std::size_t>(std::ceil(
+               n_entries / policy.max_load_factor / slots_per_group)));
+  }
+
+  /// makes optimistic readers of g retry if they overlap with the write
+  template <typename Write>
+  static void write(group &g, Write write) {
+    std::uint32_t version{g.version.load(std::memory_order_relaxed)};
+    g.version.store(version + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    write();
+    g.version.store(version + 2, std::memory_order_release);
+  }
+
+  struct probe_result {
+    group *g{nullptr};
+    slot *s{nullptr};
+    bool found{false};
+  };
+  /// the slot holding key, or else the first reusable slot on its probe
+  /// sequence; only called with the shard locked
+  template <typename K>
+  static probe_result probe(slot_array &slots, std::uint64_t h,
+                            const K &key) {
+    probe_result vacant{};
+    std::size_t n_groups{slots.groups.size()};
+    for (std::size_t i{home_group(h, n_groups)}, n_probed{0};
+         n_probed < n_groups; ++n_probed, i = i + 1 == n_groups ? 0 : i + 1) {
+      group &g{slots.groups[i]};
+      for (slot &s : g.slots) {
+        slot_state state{s.state.load(std::memory_order_relaxed)};
+        if (state == slot_state::filled) {
+          if (load(s.key) == key) return {&g, &s, true};
+          continue;
+        }
+        if (!vacant.s) vacant = {&g, &s, false};
+        if (state == slot_state::empty) return vacant;
+      }
+    }
+    return vacant;
+  }
+
+  /// probes group by group, re-reading a group whenever a writer changed it
+  /// while it was being read
+  template <typename K>
+  static bool read_optimistically(const slot_array &slots, std::uint64_t h,
+                                  const K &key, Value &value) {
+    enum class outcome { found, missing, probe_next };
+    std::size_t n_groups{slots.groups.size()};
+    for (std::size_t i{home_group(h, n_groups)}, n_probed{0};
+         n_probed < n_groups; ++n_probed, i = i + 1 == n_groups ? 0 : i + 1) {
+      const group &g{slots.groups[i]};
+      outcome result;
+      Value candidate;
+      while (true) {
+        std::uint32_t version{g.version.load(std::memory_order_acquire)};
+        if (version & 1) continue;
+        result = outcome::probe_next;
+        for (const slot &s : g.slots) {
+          slot_state state{s.state.load(std::memory_order_relaxed)};
+          if (state == slot_state::empty) {
+            result = outcome::missing;
+            break;
+          }
+          if (state == slot_state::filled && load(s.key) == key) {
+            candidate = load(s.value);
+            result = outcome::found;
+            break;
+          }
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (g.version.load(std::memory_order_relaxed) == version) break;
+      }
+      if (result == outcome::found) value = candidate;
+      if (result != outcome::probe_next) return result == outcome::found;
+    }
+    return false;
+  }
+
+  template <typename K, typename V>
+  static void fill(shard &s, const probe_result &vacant, K &&key, V &&value) {
+    bool reused{vacant.s->state.load(std::memory_order_relaxed) ==
+                slot_state::erased};
+    write(*vacant.g, [&] {
+      store(vacant.s->key, std::forward<K>(key));
+      store(vacant.s->value, std::forward<V>(value));
+      vacant.s->state.store(slot_state::filled, std::memory_order_relaxed);
+    });
+    if (!reused) ++s.n_used;
+  }
+  static void empty(const probe_result &found) {
+    write(*found.g, [&] {
+      found.s->state.store(slot_state::erased, std::memory_order_relaxed);
+    });
+  }
+
+  /// moves up to n_groups more groups of s to its next slot array, and swaps
+  /// the arrays once all of them have been moved. an entry is filled in the
+  /// new array before it is erased from the old one, so that readers, looking
+  /// in the old array first, always find it in one of the two
+  void migrate(shard &s, std::size_t n_groups) {
+    slot_array *next{s.next.load(std::memory_order_relaxed)};
+    if (!next) return;
+    slot_array *slots{s.slots.load(std::memory_order_relaxed)};
+    for (; n_groups > 0 && s.n_migrated < slots->groups.size();
+         --n_groups, ++s.n_migrated) {
+      group &g{slots->groups[s.n_migrated]};
+      for (slot &entry : g.slots) {
+        if (entry.state.load(std::memory_order_relaxed) != slot_state::filled)
+          continue;
+        probe_result vacant{
+            probe(*next, hash(load(entry.key)), load(entry.key))};
+        // prepare_write sizes next so that the migration ends before it fills
+        assert(vacant.s);
+        fill(s, vacant, take(entry.key), take(entry.value));
+        empty({&g, &entry, true});
+      }
+    }
+    if (s.n_migrated < slots->groups.size()) return;
+    s.slots.store(next);
+    s.next.store(nullptr);
+    s.n_migrated = 0;
+    retire(slots);
+  }
+
+  static void copy_entries(const shard &s,
+                           std::vector<std::pair<Key, Value>> &entries) {
+    for (auto &slots : {&s.slots, &s.next})
+      if (slot_array * array{slots->load(std::memory_order_relaxed)})
+        for (auto &g : array->groups)
+          for (auto &slot : g.slots)
+            if (slot.state.load(std::memory_order_relaxed) ==
+                slot_state::filled)
+              entries.emplace_back(load(slot.key), load(slot.value));
+  }
+  /// locks s exclusively, after handing its content to a snapshot still
+  /// waiting for it
+  static std::unique_lock<std::shared_mutex> lock_for_write(const shard &s) {
+    std::unique_lock lock{s.mutex};
+    if (s.pending_copy) {
+      copy_entries(s, *s.pending_copy);
+      s.pending_copy = nullptr;
+    }
+    return lock;
+  }
+
+  /// the array that writes to s go to, making sure it has room for one more
+  /// entry and advancing a running migration on the way. every write migrates
+  /// groups_per_step groups and fills at most one slot besides the migrated
+  /// entries, so a new array with room for the live entries plus one per write
+  /// until the migration ends never fills up before it does, however few of
+  /// the old slots are still live
+  slot_array &prepare_write(shard &s) {
+    migrate(s, policy.groups_per_step);
+    if (slot_array * next{s.next.load(std::memory_order_relaxed)})
+      return *next;
+    slot_array *slots{s.slots.load(std::memory_order_relaxed)};
+    if (s.n_used + 1 <= policy.max_load_factor * slots->capacity())
+      return *slots;
+    std::size_t n_groups{slots->groups.size()};
+    std::size_t n_writes{n_groups / policy.groups_per_step +
+                         (n_groups % policy.groups_per_step != 0)};
+    s.next.store(new slot_array{groups_for(std::max(
+        static_cast<std::size_t>(policy.growth_factor * (s.n_filled + 1)),
+        s.n_filled + n_writes + 1))});
+    s.n_used = 0;
+    migrate(s, policy.groups_per_step);
+    slot_array *target{s.next.load(std::memory_order_relaxed)};
+    return target ? *target : *s.slots.load(std::memory_order_relaxed);
+  }
+
+  static void prefetch_home(const slot_array &slots, std::uint64_t h) {
+    prefetch(&slots.groups[home_group(h, slots.groups.size())]);
+  }
+
+  /// reads without locking a shard, whose arrays stay protected by the
+  /// current thread's hazard pointers until the reader is destroyed
+  class shard_reader {
+    const shard &s;
+    std::atomic<void *> &slots_hp{get_hazard_pointer_for_current_thread(0)};
+    std::atomic<void *> &next_hp{get_hazard_pointer_for_current_thread(1)};
+    slot_array *slots{nullptr};
+    slot_array *next{nullptr};
+    void protect_arrays() {
+      slots = protect(slots_hp, s.slots);
+      next = protect(next_hp, s.next);
+    }
+
+   public:
+    explicit shard_reader(const shard &s) : s{s} { protect_arrays(); }
+    shard_reader(const shard_reader &) = delete;
+    shard_reader &operator=(const shard_reader &) = delete;
+    ~shard_reader() {
+      slots_hp.store(nullptr, std::memory_order_release);
+      next_hp.store(nullptr, std::memory_order_release);
+    }
+    void prefetch(std::uint64_t h) const {
+      prefetch_home(*slots, h);
+      if (next) prefetch_home(*next, h);
+    }
+    template <typename K>
+    bool read(std::uint64_t h, const K &key, Value &value) {
+      while (true) {
+        bool found{read_optimistically(*slots, h, key, value) ||
+                   (next && read_optimistically(*next, h, key, value))};
+        // a migration that started or finished meanwhile may have moved the
+        // key past this reader
+        if (found || (s.slots.load() == slots && s.next.load() == next))
+          return found;
+        protect_arrays();
+      }
+    }
+  };
+  /// the slot holding key in a shard that the caller has locked, if any
+  template <typename K>
+  static probe_result find_locked(const shard &s, std::uint64_t h,
+                                  const K &key) {
+    probe_result found{probe(*s.slots.load(), h, key)};
+    if (!found.found)
+      if (slot_array * next{s.next.load()}) found = probe(*next, h, key);
+    return found;
+  }
+  template <typename K>
+  static bool read_locked(const shard &s, std::uint64_t h, const K &key,
+                          Value &value) {
+    probe_result found{find_locked(s, h, key)};
+    if (!found.found) return false;
+    value = load(found.s->value);
+    return true;
+  }
+  /// writes to a shard that the caller has locked with lock_for_write
+  void set_locked(shard &s, std::uint64_t h, const Key &key,
+                  const Value &value) {
+    slot_array &target{prepare_write(s)};
+    probe_result found{probe(target, h, key)};
+    if (found.found) {
+      write(*found.g, [&] { store(found.s->value, value); });
+      return;
+    }
+    fill(s, found, key, value);
+    if (&target != s.slots.load(std::memory_order_relaxed)) {
+      probe_result old{probe(*s.slots.load(std::memory_order_relaxed), h, key)};
+      if (old.found) {
+        empty(old);
+        return;
+      }
+    }
+    ++s.n_filled;
+  }
+
+  struct batch_item {
+    std::size_t shard;
+    std::size_t index;
+    std::uint64_t h;
+  };
+  /// hashes every key of a batch once, groups the keys by shard in a counting
+  /// pass, and hands each shard's keys to visit as a single run, in the order
+  /// they came in. visit holds no more than that one shard's lock, so every
+  /// shard is locked once per batch and batches can never deadlock with each
+  /// other
+  template <typename KeyOf, typename Visit>
+  void for_each_shard_run(std::size_t n, KeyOf key_of, Visit visit) const {
+    std::vector<batch_item> items(n);
+    // run_begins[i + 1] counts the keys of shard i, until the prefix sum turns
+    // it into where the run of shard i + 1 begins
+    std::vector<std::size_t> run_begins(shards.size() + 1);
+    for (std::size_t i{0}; i < n; ++i) {
+      std::uint64_t h{hash(key_of(i))};
+      std::size_t shard{shard_index(h)};
+      prefetch(&shards[shard]);
+      items[i] = {shard, i, h};
+      ++run_begins[shard + 1];
+    }
+    std::partial_sum(run_begins.begin(), run_begins.end(), run_begins.begin());
+    std::vector<batch_item> runs(n);
+    std::vector<std::size_t> run_ends(run_begins.begin(),
+                                      run_begins.end() - 1);
+    for (const batch_item &item : items) runs[run_ends[item.shard]++] = item;
+    for (std::size_t shard{0}; shard < shards.size(); ++shard)
+      if (run_begins[shard] != run_ends[shard])
+        visit(std::span<const batch_item>{runs.data() + run_begins[shard],
+                                          run_ends[shard] - run_begins[shard]});
+  }
+
+  template <typename K>
+  bool read_value(const K &key, Value &value) const {
+    std::uint64_t h{hash(key)};
+    const shard &s{get_shard(h)};
+    if constexpr (optimistic_reads) {
+      return shard_reader{s}.read(h, key, value);
+    } else {
+      std::shared_lock lock{s.mutex};
+      return read_locked(s, h, key, value);
+    }
+  }
+  template <typename K, typename Visit>
+  bool visit_value(const K &key, Visit visit) const {
+    std::uint64_t h{hash(key)};
+    const shard &s{get_shard(h)};
+    if constexpr (optimistic_reads) {
+      Value value;
+      if (!shard_reader{s}.read(h, key, value)) return false;
+      std::invoke(visit, std::as_const(value));
+    } else {
+      std::shared_lock lock{s.mutex};
+      probe_result found{find_locked(s, h, key)};
+      if (!found.found) return false;
+      std::invoke(visit, std::as_const(found.s->value));
+    }
+    return true;
+  }
+  template <typename K, typename... Args>
+  bool emplace_value(K &&key, Args &&...args) {
+    std::uint64_t h{hash(key)};
+    shard &s{get_shard(h)};
+    auto lock{lock_for_write(s)};
+    slot_array &target{prepare_write(s)};
+    if (find_locked(s, h, key).found) return false;
+    fill(s, probe(target, h, key), Key(std::forward<K>(key)),
+         Value(std::forward<Args>(args)...));
+    ++s.n_filled;
+    return true;
+  }
+  template <typename K, typename Update>
+  bool update_value(const K &key, Update update) {
+    std::uint64_t h{hash(key)};
+    shard &s{get_shard(h)};
+    auto lock{lock_for_write(s)};
+    probe_result found{find_locked(s, h, key)};
+    if (!found.found) return false;
+    if constexpr (optimistic_reads) {
+      Value value{load(found.s->value)};
+      std::invoke(update, value);
+      write(*found.g, [&] { store(found.s->value, value); });
+    } else {
+      // readers hold the shared lock, so the value can change in place
+      std::invoke(update, found.s->value);
+    }
+    return true;
+  }
+  template <typename K>
+  void erase_key(const K &key) {
+    std::uint64_t h{hash(key)};
+    shard &s{get_shard(h)};
+    auto lock{lock_for_write(s)};
+    migrate(s, policy.groups_per_step);
+    for (auto &slots : {&s.slots, &s.next})
+      if (slot_array * array{slots->load(std::memory_order_relaxed)}) {
+        probe_result found{probe(*array, h, key)};
+        if (!found.found) continue;
+        empty(found);
+        --s.n_filled;
+        return;
+      }
+  }
+
+ public:
+  explicit threadsafe_lookup_table(std::size_t capacity,
+                                   resize_policy policy = {})
+      : policy{policy},
+        shards(std::clamp<std::size_t>(
+            std::bit_ceil(4 * std::thread::hardware_concurrency()), 1,
+            max_shards)) {
+    if (!(policy.max_load_factor > 0.0 && policy.max_load_factor < 1.0))
+      throw std::invalid_argument{"max_load_factor must be in (0, 1)"};
+    if (!(policy.growth_factor > 1.0))
+      throw std::invalid_argument{"growth_factor must exceed 1"};
+    if (policy.groups_per_step == 0)
+      throw std::invalid_argument{"groups_per_step must be positive"};
+    for (auto &s : shards)
+      s.slots = new slot_array{groups_for(capacity / shards.size())};
+  }
+  threadsafe_lookup_table(const threadsafe_lookup_table &) = delete;
+  threadsafe_lookup_table &operator=(const threadsafe_lookup_table &) = delete;
+  ~threadsafe_lookup_table() {
+    for (auto &s : shards) {
+      delete s.slots.load();
+      delete s.next.load();
+    }
+  }
+  bool try_get(const Key &key, Value &value) const {
+    return read_value(key, value);
+  }
+  template <typename K>
+    requires is_transparent_key<K>
+  bool try_get(const K &key, Value &value) const {
+    return read_value(key, value);
+  }
+  /// calls visit with the value of key, if any, without copying it out of the
+  /// table unless its reads are lock-free; returns whether key was found
+  template <typename Visit>
+  bool visit(const Key &key, Visit visit) const {
+    return visit_value(key, std::move(visit));
+  }
+  template <typename K, typename Visit>
+    requires is_transparent_key<K>
+  bool visit(const K &key, Visit visit) const {
+    return visit_value(key, std::move(visit));
+  }
+  /// looks up all keys, visiting each shard once, and leaves out[i] empty for
+  /// each keys[i] not found; returns the number of keys found
+  std::size_t multi_get(std::span<const Key> keys,
+                        std::span<std::optional<Value>> out) const {
+    if (out.size() < keys.size())
+      throw std::invalid_argument{"out is shorter than keys"};
+    std::size_t n_found{0};
+    for_each_shard_run(
+        keys.size(), [keys](std::size_t i) -> const Key & { return keys[i]; },
+        [&](std::span<const batch_item> run) {
+          const shard &s{shards[run.front().shard]};
+          auto read_run = [&](auto read) {
+            for (const batch_item &item : run) {
+              Value value;
+              if (read(item.h, keys[item.index], value)) {
+                out[item.index] = std::move(value);
+                ++n_found;
+              } else {
+                out[item.index].reset();
+              }
+            }
+          };
+          if constexpr (optimistic_reads) {
+            shard_reader reader{s};
+            for (const batch_item &item : run) reader.prefetch(item.h);
+            read_run([&reader](std::uint64_t h, const Key &key, Value &value) {
+              return reader.read(h, key, value);
+            });
+          } else {
+            std::shared_lock lock{s.mutex};
+            for (const batch_item &item : run)
+              prefetch_home(*s.slots.load(), item.h);
+            read_run([&s](std::uint64_t h, const Key &key, Value &value) {
+              return read_locked(s, h, key, value);
+            });
+          }
+        });
+    return n_found;
+  }
+  void set(const Key &key, const Value &value) {
+    std::uint64_t h{hash(key)};
+    shard &s{get_shard(h)};
+    auto lock{lock_for_write(s)};
+    set_locked(s, h, key, value);
+  }
+  /// inserts key with a value constructed from args, unless key is present
+  /// already; returns whether it inserted
+  template <typename... Args>
+  bool try_emplace(const Key &key, Args &&...args) {
+    return emplace_value(key, std::forward<Args>(args)...);
+  }
+  template <typename K, typename... Args>
+    requires is_transparent_key<K> && std::constructible_from<Key, K>
+  bool try_emplace(K &&key, Args &&...args) {
+    return emplace_value(std::forward<K>(key), std::forward<Args>(args)...);
+  }
+  /// calls update with the value of key, if any, under the lock of its shard;
+  /// returns whether key was found
+  template <typename Update>
+  bool update(const Key &key, Update update) {
+    return update_value(key, std::move(update));
+  }
+  template <typename K, typename Update>
+    requires is_transparent_key<K>
+  bool update(const K &key, Update update) {
+    return update_value(key, std::move(update));
+  }
+  /// sets all entries, locking each shard once; of entries with the same
+  /// key, the last one wins
+  void multi_set(std::span<const std::pair<Key, Value>> entries) {
+    for_each_shard_run(
+        entries.size(),
+        [entries](std::size_t i) -> const Key & { return entries[i].first; },
+        [&](std::span<const batch_item> run) {
+          shard &s{shards[run.front().shard]};
+          auto lock{lock_for_write(s)};
+          slot_array *target{s.next.load(std::memory_order_relaxed)};
+          if (!target) target = s.slots.load(std::memory_order_relaxed);
+          for (const batch_item &item : run) prefetch_home(*target, item.h);
+          for (const batch_item &item : run)
+            set_locked(s, item.h, entries[item.index].first,
+                       entries[item.index].second);
+        });
+  }
+  void erase(const Key &key) { erase_key(key); }
+  template <typename K>
+    requires is_transparent_key<K>
+  void erase(const K &key) {
+    erase_key(key);
+  }
+  /// all entries as of one point in time, sorted by key. the blocking mode
+  /// keeps every shard locked while it copies them; copy_on_write only locks
+  /// them all to mark them, after which each shard is copied either by the
+  /// snapshot or by the first write to it, whichever comes first
+  [[nodiscard]] std::vector<std::pair<Key, Value>> snapshot(
+      snapshot_mode mode = snapshot_mode::copy_on_write) const {
+    std::vector<std::pair<Key, Value>> result;
+    if (mode == snapshot_mode::blocking) {
+      std::vector<std::shared_lock<std::shared_mutex>> locks(shards.size());
+      for (std::size_t i{0}; i < shards.size(); ++i)
+        locks[i] = std::shared_lock{shards[i].mutex};
+      for (auto &s : shards) copy_entries(s, result);
+    } else {
+      std::scoped_lock lock{snapshot_mutex};
+      std::vector<std::vector<std::pair<Key, Value>>> copies(shards.size());
+      {
+        std::vector<std::unique_lock<std::shared_mutex>> locks(shards.size());
+        for (std::size_t i{0}; i < shards.size(); ++i) {
+          locks[i] = std::unique_lock{shards[i].mutex};
+          shards[i].pending_copy = &copies[i];
+        }
+      }
+      // copies whichever shards have not been written to since
+      for (auto &s : shards) lock_for_write(s);
+      for (auto &copy : copies)
+        result.insert(result.end(), std::make_move_iterator(copy.begin()),
+                      std::make_move_iterator(copy.end()));
+    }
+    std::sort(result.begin(), result.end(),
+              [](const auto &a, const auto &b) { return a.first < b.first; });
+    return result;
+  }
+};
+
+struct cache_stats {
+  long long hits{0};
+  long long misses{0};
+  long long evictions{0};
+};
+
+/// a size-bounded memoization cache over threadsafe_lookup_table, split into
+/// shards that each evict with their own CLOCK hand. a hit only reads the
+/// table and sets a reference bit, while a miss locks its shard to make room.
+/// the table maps keys to raw entry pointers, so that hits can read it without
+/// locking, and evicted entries are reclaimed through hazard pointers
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+  requires HashFor<Hash, Key>
+class threadsafe_cache {
+  struct entry {
+    /// ready once the computation of the value has finished
+    std::shared_future<Value> value;
+    std::atomic<bool> referenced{false};
+  };
+  struct alignas(cache_line_size) cache_shard {
+    std::mutex mutex;
+    std::size_t capacity{0};
+    // guarded by mutex; filled up to capacity, then replaced in place, with a
+    // null entry standing for a free slot
+    std::vector<std::pair<Key, entry *>> ring;
+    std::size_t hand{0};
+    std::atomic<long long> n_hits{0};
+    std::atomic<long long> n_misses{0};
+    std::atomic<long long> n_evictions{0};
+  };
+  static constexpr std::size_t min_capacity_per_shard{8};
+  std::vector<cache_shard> shards;
+  threadsafe_lookup_table<Key, entry *, Hash> table;
+  Hash hasher;
+
+  cache_shard &get_shard(const Key &key) {
+    std::uint64_t h{hasher(key) * 0x9E3779B97F4A7C15};
+    return shards[(h >> 40) % shards.size()];
+  }
+
+  /// the entry of key published in hp, which is only known to be safe once
+  /// the table still maps key to it after publication
+  entry *find(const Key &key, std::atomic<void *> &hp) {
+    entry *e;
+    if (!table.try_get(key, e)) return nullptr;
+    while (true) {
+      hp.store(e);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      entry *current;
+      if (!table.try_get(key, current)) return nullptr;
+      if (current == e) return e;
+      e = current;
+    }
+  }
+  void unmap(const Key &key, entry *e) {
+    table.erase(key);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    retire(e);
+  }
+  /// maps key to e, evicting the first entry the hand finds unreferenced.
+  /// new entries start unreferenced, but only come up after a full round
+  void insert(cache_shard &s, const Key &key, entry *e) {
+    table.set(key, e);
+    if (s.ring.size() < s.capacity) {
+      s.ring.emplace_back(key, e);
+      return;
+    }
+    while (true) {
+      auto &[victim_key, victim] = s.ring[s.hand];
+      s.hand = (s.hand + 1) % s.ring.size();
+      if (victim && victim->referenced.exchange(false)) continue;
+      if (victim) {
+        unmap(victim_key, victim);
+        ++s.n_evictions;
+      }
+      victim_key = key;
+      victim = e;
+      return;
+    }
+  }
+  /// drops a failed computation, so that the next caller tries again
+  void forget(cache_shard &s, const Key &key, entry *e) {
+    std::scoped_lock lock{s.mutex};
+    auto slot{std::find_if(s.ring.begin(), s.ring.end(),
+                           [e](const auto &slot) { return slot.second == e; })};
+    if (slot == s.ring.end()) return;  // evicted already
+    slot->second = nullptr;
+    unmap(key, e);
+  }
+  static Value hit(cache_shard &s, entry &e) {
+    if (!e.referenced.load(std::memory_order_relaxed))
+      e.referenced.store(true, std::memory_order_relaxed);
+    s.n_hits.fetch_add(1, std::memory_order_relaxed);
+    return e.value.get();
+  }
+
+ public:
+  explicit threadsafe_cache(std::size_t capacity)
+      : shards(std::clamp<std::size_t>(
+            std::bit_ceil(4 * std::thread::hardware_concurrency()), 1,
+            std::max<std::size_t>(capacity / min_capacity_per_shard, 1))),
+        table{capacity} {
+    if (capacity == 0) throw std::invalid_argument{"capacity must be positive"};
+    for (std::size_t i{0}; i < shards.size(); ++i)
+      shards[i].capacity =
+          capacity / shards.size() + (i < capacity % shards.size());
+  }
+  threadsafe_cache(const threadsafe_cache &) = delete;
+  threadsafe_cache &operator=(const threadsafe_cache &) = delete;
+  ~threadsafe_cache() {
+    for (auto &s : shards)
+      for (auto &slot : s.ring) delete slot.second;
+  }
+  /// the cached value of key, or else the value computed by compute(key).
+  /// concurrent misses of the same key wait for the one computation, and all
+  /// of them see the exception if it throws
+  template <typename Compute>
+    requires std::is_invocable_r_v<Value, Compute, const Key &>
+  Value get_or_compute(const Key &key, Compute compute) {
+    std::atomic<void *> &hp{get_hazard_pointer_for_current_thread(2)};
+    struct hp_guard {
+      std::atomic<void *> &hp;
+      ~hp_guard() { hp.store(nullptr, std::memory_order_release); }
+    } guard{hp};
+    cache_shard &s{get_shard(key)};
+    if (entry *found{find(key, hp)}) return hit(s, *found);
+    std::promise<Value> promise;
+    entry *computing;
+    {
+      std::unique_lock lock{s.mutex};
+      // keys of this shard only get mapped under its lock
+      if (table.try_get(key, computing)) {
+        hp.store(computing);
+        lock.unlock();
+        return hit(s, *computing);
+      }
+      computing = new entry{promise.get_future().share()};
+      hp.store(computing);
+      insert(s, key, computing);
+      s.n_misses.fetch_add(1, std::memory_order_relaxed);
+    }
+    try {
+      promise.set_value(compute(key));
+    } catch (...) {
+      promise.set_exception(std::current_exception());
+      forget(s, key, computing);
+    }
+    return computing->value.get();
+  }
+  [[nodiscard]] cache_stats stats() const {
+    cache_stats total;
+    for (auto &s : shards) {
+      total.hits += s.n_hits.load(std::memory_order_relaxed);
+      total.misses += s.n_misses.load(std::memory_order_relaxed);
+      total.evictions += s.n_evictions.load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+};
+
+/// Gray et al.'s generator of zipfian ranks in [0, n), as used by YCSB
+class zipfian_distribution {
+  std::uint64_t n;
+  double theta;
+  double alpha;
+  double zeta_n;
+  double eta;
+  static double zeta(std::uint64_t n, double theta) {
+    double sum{0.0};
+    for (std::uint64_t i{1}; i <= n; ++i) sum += 1.0 / std::pow(i, theta);
+    return sum;
+  }
+
+ public:
+  explicit zipfian_distribution(std::uint64_t n, double theta = 0.99)
+      : n{n},
+        theta{theta},
+        alpha{1.0 / (1.0 - theta)},
+        zeta_n{zeta(n, theta)},
+        eta{(1.0 - std::pow(2.0 / n, 1.0 - theta)) /
+            (1.0 - zeta(2, theta) / zeta_n)} {}
+  template <typename Engine>
+  std::uint64_t operator()(Engine &engine) {
+    double u{std::uniform_real_distribution<>{}(engine)};
+    double uz{u * zeta_n};
+    if (uz < 1.0) return 0;
+    if (uz < 1.0 + std::pow(0.5, theta)) return 1;
+    return std::min(
+        n - 1,
+        static_cast<std::uint64_t>(n * std::pow(eta * u - eta + 1.0, alpha)));
+  }
+};
+
+/// YCSB-style mix of reads and updates of zipfian-popular keys among n_records
+/// preloaded ones; returns operations per second
+template <typename Table>
+double run_workload(Table &table, int n_records, int n_threads,
+                    int n_operations_per_thread, double read_proportion) {
+  zipfian_distribution popularity{static_cast<std::uint64_t>(n_records)};
+  std::vector<std::vector<int>> keys(n_threads);
+  std::vector<std::vector<bool>> is_read(n_threads);
+  for (int i_thread{0}; i_thread < n_threads; ++i_thread) {
+    std::default_random_engine engine{std::random_device{}()};
+    std::bernoulli_distribution read{read_proportion};
+    for (int i{0}; i < n_operations_per_thread; ++i) {
+      // scattered, so that the popular keys are not neighbours
+      std::uint64_t rank{popularity(engine)};
+      keys[i_thread].push_back(
+          static_cast<int>(rank * 0x9E3779B97F4A7C15 % n_records));
+      is_read[i_thread].push_back(read(engine));
+    }
+  }
+  std::latch latch{n_threads + 1};
+  std::vector<std::thread> threads;
+  std::atomic<long long> n_found{0};
+  for (int i_thread{0}; i_thread < n_threads; ++i_thread)
+    threads.emplace_back([&, i_thread] {
+      long long found{0};
+      latch.arrive_and_wait();
+      for (int i{0}; i < n_operations_per_thread; ++i) {
+        int key{keys[i_thread][i]};
+        if (is_read[i_thread][i]) {
+          int value;
+          found += table.try_get(key, value);
+        } else {
+          table.set(key, i);
+        }
+      }
+      n_found += found;
+    });
+  latch.arrive_and_wait();
+  auto start_time{std::chrono::steady_clock::now()};
+  for (auto &thread : threads) thread.join();
+  auto elapsed{std::chrono::steady_clock::now() - start_time};
+  assert(n_found > 0 || read_proportion == 0.0);
+  return 1.0 * n_threads * n_operations_per_thread /
+         std::chrono::duration<double>(elapsed).count();
+}
+
+template <typename Table>
+void report(const char *name, int n_records, int n_operations_per_thread) {
+  Table table{static_cast<std::size_t>(n_records)};
+  for (int key{0}; key < n_records; ++key) table.set(key, key);
+  const int max_threads{
+      std::max(2, static_cast<int>(std::thread::hardware_concurrency()))};
+  const std::pair<const char *, double> workloads[]{
+      {"A (50% reads)", 0.5}, {"B (95% reads)", 0.95}, {"C (100% reads)", 1.0}};
+  for (auto [workload, read_proportion] : workloads)
+    for (int n_threads{1};; n_threads = std::min(n_threads * 2, max_threads)) {
+      std::cout << name << '\t' << workload << '\t' << n_threads
+                << " threads\t"
+                << run_workload(table, n_records, n_threads,
+                                n_operations_per_thread, read_proportion)
+                << " ops/s\n";
+      if (n_threads == max_threads) break;
+    }
+}
+
+void print_percentiles(const char *name, std::vector<std::uint32_t> latencies) {
+  std::sort(latencies.begin(), latencies.end());
+  std::cout << '\t' << name;
+  for (double percentile : {50.0, 99.0, 99.9, 100.0}) {
+    auto rank{static_cast<std::size_t>(percentile / 100.0 *
+                                       (latencies.size() - 1))};
+    std::cout << " p" << percentile << ' ' << latencies[rank] << "ns";
+  }
+}
+
+/// writers insert n_keys into a table sized for 16 entries, while a reader
+/// looks up keys at random; every operation is timed
+void report_growth(const char *name, resize_policy policy, int n_keys) {
+  using clock = std::chrono::steady_clock;
+  auto nanoseconds_since = [](clock::time_point start_time) {
+    return static_cast<std::uint32_t>(std::min<long long>(
+        std::numeric_limits<std::uint32_t>::max(),
+        std::chrono::nanoseconds{clock::now() - start_time}.count()));
+  };
+  threadsafe_lookup_table<int, int> table{16, policy};
+  const int n_writers{
+      std::max(1, static_cast<int>(std::thread::hardware_concurrency()))};
+  std::vector<std::vector<std::uint32_t>> set_latencies(n_writers);
+  std::vector<std::uint32_t> get_latencies;
+  std::atomic<bool> done{false};
+  std::latch latch{n_writers + 2};
+  std::vector<std::thread> writers;
+  for (int i_writer{0}; i_writer < n_writers; ++i_writer)
+    writers.emplace_back([&, i_writer] {
+      auto &latencies{set_latencies[i_writer]};
+      latencies.reserve(n_keys / n_writers + 1);
+      latch.arrive_and_wait();
+      for (int key{i_writer}; key < n_keys; key += n_writers) {
+        auto start_time{clock::now()};
+        table.set(key, key);
+        latencies.push_back(nanoseconds_since(start_time));
+      }
+    });
+  std::thread reader{[&] {
+    std::default_random_engine engine{std::random_device{}()};
+    std::uniform_int_distribution<int> keys{0, n_keys - 1};
+    latch.arrive_and_wait();
+    while (!done) {
+      int key{keys(engine)};
+      int value;
+      auto start_time{clock::now()};
+      bool found{table.try_get(key, value)};
+      get_latencies.push_back(nanoseconds_since(start_time));
+      assert(!found || value == key);
+    }
+  }};
+  latch.arrive_and_wait();
+  auto start_time{clock::now()};
+  for (auto &writer : writers) writer.join();
+  auto elapsed{clock::now() - start_time};
+  done = true;
+  reader.join();
+  std::vector<std::uint32_t> all_set_latencies;
+  for (auto &latencies : set_latencies)
+    all_set_latencies.insert(all_set_latencies.end(), latencies.begin(),
+                             latencies.end());
+  std::cout << name << '\t' << n_writers << " writers\t"
+            << n_keys / std::chrono::duration<double>(elapsed).count()
+            << " sets/s";
+  print_percentiles("set", std::move(all_set_latencies));
+  print_percentiles("get", std::move(get_latencies));
+  std::cout << '\n';
+}
+
+/// threads read zipfian-popular keys through a cache holding a fraction of
+/// them, paying for each miss with a computation of about a microsecond
+void report_cache(double cached_fraction, int n_keys,
+                  int n_operations_per_thread) {
+  auto compute = [](int key) {
+    std::uint64_t h{static_cast<std::uint64_t>(key)};
+    for (int i{0}; i < 256; ++i)
+      h = h * 6364136223846793005 + 1442695040888963407;
+    return static_cast<int>(h >> 33);
+  };
+  zipfian_distribution popularity{static_cast<std::uint64_t>(n_keys)};
+  const int max_threads{
+      std::max(2, static_cast<int>(std::thread::hardware_concurrency()))};
+  std::vector<std::vector<int>> keys(max_threads);
+  for (auto &thread_keys : keys) {
+    std::default_random_engine engine{std::random_device{}()};
+    for (int i{0}; i < n_operations_per_thread; ++i)
+      thread_keys.push_back(static_cast<int>(
+          popularity(engine) * 0x9E3779B97F4A7C15 % n_keys));
+  }
+  for (int n_threads{1};; n_threads = std::min(n_threads * 2, max_threads)) {
+    threadsafe_cache<int, int> cache{
+        static_cast<std::size_t>(cached_fraction * n_keys)};
+    std::latch latch{n_threads + 1};
+    std::vector<std::thread> threads;
+    for (int i_thread{0}; i_thread < n_threads; ++i_thread)
+      threads.emplace_back([&, i_thread] {
+        latch.arrive_and_wait();
+        for (int key : keys[i_thread])
+          assert(cache.get_or_compute(key, compute) == compute(key));
+      });
+    latch.arrive_and_wait();
+    auto start_time{std::chrono::steady_clock::now()};
+    for (auto &thread : threads) thread.join();
+    auto elapsed{std::chrono::steady_clock::now() - start_time};
+    cache_stats stats{cache.stats()};
+    std::cout << "cache of " << cached_fraction * 100 << "% keys\t"
+              << n_threads << " threads\t"
+              << 100.0 * stats.hits / (stats.hits + stats.misses)
+              << "% hits\t"
+              << 1.0 * n_threads * n_operations_per_thread /
+                     std::chrono::duration<double>(elapsed).count()
+              << " ops/s\t" << stats.evictions << " evictions\n";
+    if (n_threads == max_threads) break;
+  }
+}
+
+/// threads look up or set random keys, batch by batch, either through the
+/// batched calls or through one call per key
+void report_batches(int n_keys, int n_keys_per_thread) {
+  threadsafe_lookup_table<int, int> table{static_cast<std::size_t>(n_keys)};
+  for (int key{0}; key < n_keys; ++key) table.set(key, key);
+  const int n_threads{
+      std::max(1, static_cast<int>(std::thread::hardware_concurrency()))};
+  std::vector<std::vector<int>> keys(n_threads);
+  for (auto &thread_keys : keys) {
+    std::default_random_engine engine{std::random_device{}()};
+    std::uniform_int_distribution<int> distribution{0, n_keys - 1};
+    for (int i{0}; i < n_keys_per_thread; ++i)
+      thread_keys.push_back(distribution(engine));
+  }
+  auto measure = [&](auto process_batch, std::size_t batch_size) {
+    std::latch latch{n_threads + 1};
+    std::vector<std::thread> threads;
+    for (int i_thread{0}; i_thread < n_threads; ++i_thread)
+      threads.emplace_back([&, i_thread] {
+        std::vector<std::optional<int>> values(batch_size);
+        std::vector<std::pair<int, int>> entries(batch_size);
+        std::span<const int> thread_keys{keys[i_thread]};
+        latch.arrive_and_wait();
+        for (std::size_t begin{0}; begin + batch_size <= thread_keys.size();
+             begin += batch_size)
+          process_batch(thread_keys.subspan(begin, batch_size), values,
+                        entries);
+      });
+    latch.arrive_and_wait();
+    auto start_time{std::chrono::steady_clock::now()};
+    for (auto &thread : threads) thread.join();
+    auto elapsed{std::chrono::steady_clock::now() - start_time};
+    return 1.0 * n_threads * n_keys_per_thread /
+           std::chrono::duration<double>(elapsed).count();
+  };
+  auto single_gets = [&table](std::span<const int> batch, auto &values,
+                              auto &) {
+    for (std::size_t i{0}; i < batch.size(); ++i)
+      if (int value; table.try_get(batch[i], value))
+        values[i] = value;
+      else
+        values[i].reset();
+  };
+  auto multi_get = [&table](std::span<const int> batch, auto &values, auto &) {
+    table.multi_get(batch, values);
+  };
+  auto single_sets = [&table](std::span<const int> batch, auto &, auto &) {
+    for (int key : batch) table.set(key, -key);
+  };
+  auto multi_set = [&table](std::span<const int> batch, auto &,
+                            auto &entries) {
+    for (std::size_t i{0}; i < batch.size(); ++i)
+      entries[i] = {batch[i], -batch[i]};
+    table.multi_set(entries);
+  };
+  for (std::size_t batch_size : {8, 64, 512}) {
+    std::cout << "batches of " << batch_size << '\t' << n_threads
+              << " threads\ttry_get " << measure(single_gets, batch_size)
+              << " keys/s\tmulti_get " << measure(multi_get, batch_size)
+              << " keys/s\tset " << measure(single_sets, batch_size)
+              << " keys/s\tmulti_set " << measure(multi_set, batch_size)
+              << " keys/s\n";
+  }
+}
+
+/// writers update random keys, timing every set, while another thread keeps
+/// taking snapshots (unless there is no mode to take them in)
+void report_snapshot_impact(const char *name,
+                            std::optional<snapshot_mode> mode, int n_keys,
+                            int n_sets_per_writer) {
+  using clock = std::chrono::steady_clock;
+  threadsafe_lookup_table<int, int> table{static_cast<std::size_t>(n_keys)};
+  for (int key{0}; key < n_keys; ++key) table.set(key, key);
+  const int n_writers{
+      std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1)};
+  std::vector<std::vector<std::uint32_t>> set_latencies(n_writers);
+  std::atomic<bool> done{false};
+  std::latch latch{n_writers + 1};
+  std::vector<std::thread> writers;
+  for (int i_writer{0}; i_writer < n_writers; ++i_writer)
+    writers.emplace_back([&, i_writer] {
+      std::default_random_engine engine{std::random_device{}()};
+      std::uniform_int_distribution<int> keys{0, n_keys - 1};
+      auto &latencies{set_latencies[i_writer]};
+      latencies.reserve(n_sets_per_writer);
+      latch.arrive_and_wait();
+      for (int i{0}; i < n_sets_per_writer; ++i) {
+        int key{keys(engine)};
+        auto start_time{clock::now()};
+        table.set(key, i);
+        latencies.push_back(static_cast<std::uint32_t>(std::min<long long>(
+            std::numeric_limits<std::uint32_t>::max(),
+            std::chrono::nanoseconds{clock::now() - start_time}.count())));
+      }
+    });
+  int n_snapshots{0};
+  std::thread snapshotter{[&] {
+    latch.arrive_and_wait();
+    if (!mode) return;
+    for (; !done; ++n_snapshots)
+      assert(table.snapshot(*mode).size() ==
+             static_cast<std::size_t>(n_keys));
+  }};
+  for (auto &writer : writers) writer.join();
+  done = true;
+  snapshotter.join();
+  std::vector<std::uint32_t> all_set_latencies;
+  for (auto &latencies : set_latencies)
+    all_set_latencies.insert(all_set_latencies.end(), latencies.begin(),
+                             latencies.end());
+  std::cout << name << '\t' << n_writers << " writers\t" << n_snapshots
+            << " snapshots";
+  print_percentiles("set", std::move(all_set_latencies));
+  std::cout << '\n';
+}
+
+/// looks up and rewrites existing string keys through string_views, or
+/// through std::strings built from them, counting allocations per operation
+void report_string_lookups(int n_keys, int n_operations) {
+  using string_table = threadsafe_lookup_table<std::string, std::string,
+                                               string_hash>;
+  string_table table{static_cast<std::size_t>(n_keys)};
+  std::vector<std::string> keys;
+  for (int i{0}; i < n_keys; ++i) {
+    // longer than any small string buffer
+    keys.push_back("a/rather/long/path/to/record/number/" + std::to_string(i));
+    table.set(keys.back(), std::string(100, 'x'));
+  }
+  std::default_random_engine engine{std::random_device{}()};
+  std::uniform_int_distribution<int> distribution{0, n_keys - 1};
+  std::vector<std::string_view> views;
+  for (int i{0}; i < n_operations; ++i)
+    views.push_back(keys[distribution(engine)]);
+  const std::string new_value(100, 'y');
+  auto measure = [&](const char *name, auto operation) {
+    long long n_allocations_before{n_allocations};
+    auto start_time{std::chrono::steady_clock::now()};
+    for (std::string_view view : views) operation(view);
+    auto elapsed{std::chrono::steady_clock::now() - start_time};
+    std::cout << '\t' << name << ' '
+              << n_operations / std::chrono::duration<double>(elapsed).count()
+              << " ops/s "
+              << 1.0 * (n_allocations - n_allocations_before) / n_operations
+              << " allocs/op";
+  };
+  std::string value;
+  std::cout << "string keys";
+  measure("try_get(string)", [&](std::string_view view) {
+    table.try_get(std::string{view}, value);
+  });
+  measure("try_get(view)",
+          [&](std::string_view view) { table.try_get(view, value); });
+  measure("visit(view)", [&](std::string_view view) {
+    table.visit(view, [&](const std::string &v) { value.assign(v); });
+  });
+  measure("set(string)", [&](std::string_view view) {
+    table.set(std::string{view}, new_value);
+  });
+  measure("update(view)", [&](std::string_view view) {
+    table.update(view, [&](std::string &v) { v.assign(new_value); });
+  });
+  measure("try_emplace(view)", [&](std::string_view view) {
+    table.try_emplace(view, new_value);
+  });
+  std::cout << '\n';
+}
+
 int main() {
   std::atomic<long long> expected_sum{0LL};
   const int n_threads{static_cast<int>(std::thread::hardware_concurrency())};
@@ -115,8 +1516,10 @@ int main() {
   }
   {
     long long actual_sum{0LL};
-    auto map{table.snapshot()};
-    for (const auto &p : map) actual_sum += p.second;
+    auto entries{table.snapshot()};
+    assert(std::is_sorted(entries.begin(), entries.end()));
+    for (const auto &p : entries) actual_sum += p.second;
+    assert(entries == table.snapshot(snapshot_mode::blocking));
     assert(actual_sum == expected_sum);
   }
   {
@@ -132,6 +1535,292 @@ int main() {
       table.set(key, key);
       if (table.try_get(key, value)) sum += value;
     }
-    assert(sum == n_items * (n_items - 1) / 2);
+    assert(sum == n_items * (n_items - 1LL) / 2);
+  }
+  {
+    // optimistic readers must never see a value torn from another key's, even
+    // while writers keep erasing, reinserting and rehashing
+    const int n_keys{1'000};
+    threadsafe_lookup_table<int, long long> versions{16};
+    std::atomic<bool> done{false};
+    std::vector<std::thread> threads;
+    for (int i_writer{0}; i_writer < 2; ++i_writer)
+      threads.emplace_back([i_writer, &versions] {
+        for (long long round{0}; round < 50; ++round)
+          for (int key{i_writer}; key < n_keys; key += 2) {
+            versions.set(key, round * n_keys + key);
+            if (round % 3 == 0) versions.erase(key);
+          }
+      });
+    for (int i_reader{0}; i_reader < 2; ++i_reader)
+      threads.emplace_back([&versions, &done] {
+        while (!done)
+          for (int key{0}; key < n_keys; ++key)
+            if (long long value; versions.try_get(key, value))
+              assert(value % n_keys == key);
+      });
+    threads[0].join();
+    threads[1].join();
+    done = true;
+    for (auto &thread : threads)
+      if (thread.joinable()) thread.join();
+    auto entries{versions.snapshot()};
+    assert(entries.size() == n_keys);
+    for (auto &[key, value] : entries) assert(value == 49 * n_keys + key);
+  }
+  {
+    // keys must stay visible to readers while their shard migrates
+    const int n_keys{100'000};
+    threadsafe_lookup_table<int, int> growing{16, {.groups_per_step = 1}};
+    std::atomic<int> n_inserted{0};
+    std::thread reader{[&growing, &n_inserted] {
+      std::default_random_engine engine{std::random_device{}()};
+      for (int bound; (bound = n_inserted) < n_keys;) {
+        if (bound == 0) continue;
+        int key{std::uniform_int_distribution<int>{0, bound - 1}(engine)};
+        int value;
+        assert(growing.try_get(key, value) && value == key);
+      }
+    }};
+    for (int key{0}; key < n_keys; ++key) {
+      growing.set(key, key);
+      n_inserted = key + 1;
+    }
+    reader.join();
+    for (int key{0}; key < n_keys; key += 2) growing.erase(key);
+    for (int key{0}, value; key < n_keys; ++key)
+      assert(growing.try_get(key, value) == (key % 2 == 1));
+    assert(growing.snapshot().size() == n_keys / 2);
+  }
+  for (std::size_t groups_per_step : {1, 4, 8, 16}) {
+    // a shard filled up to its threshold and then emptied but for a few keys
+    // migrates to a small array, which has to take both the keys still left
+    // in the old one and the inserts that go on meanwhile. the shard starts
+    // out as small as it gets and grows with the fill; the fills that start a
+    // migration are the ones that allocate a new array, so a first table
+    // finds them and a fresh one is filled up to each
+    const resize_policy policy{.groups_per_step = groups_per_step};
+    const int n_min{5'000};
+    const int n_max{20'000};
+    const int n_kept{40};
+    std::vector<int> allocating_fills;
+    {
+      threadsafe_lookup_table<int, int, first_shard_hash> growing{0, policy};
+      for (int key{0}; key < n_max; ++key) {
+        long long allocations_before{n_allocations};
+        growing.set(key, key);
+        if (n_allocations != allocations_before && key >= n_min)
+          allocating_fills.push_back(key);
+      }
+    }
+    assert(!allocating_fills.empty());
+    for (int n_filled : allocating_fills) {
+      threadsafe_lookup_table<int, int, first_shard_hash> emptied{0, policy};
+      for (int key{0}; key < n_filled; ++key) emptied.set(key, key);
+      for (int key{n_kept}; key < n_filled; ++key) emptied.erase(key);
+      for (int key{n_filled}; key < 2 * n_filled; ++key) emptied.set(key, key);
+      for (int key{0}, value; key < 2 * n_filled; ++key) {
+        bool kept{key < n_kept || key >= n_filled};
+        assert(emptied.try_get(key, value) == kept);
+        assert(!kept || value == key);
+      }
+      assert(emptied.snapshot().size() ==
+             static_cast<std::size_t>(n_filled + n_kept));
+    }
+  }
+  {
+    // a writer sweeps through the keys in order, round after round, so any
+    // point-in-time view has the keys below the sweep one round ahead
+    const int n_keys{10'000};
+    threadsafe_lookup_table<int, int> rounds{n_keys};
+    for (int key{0}; key < n_keys; ++key) rounds.set(key, 0);
+    std::atomic<bool> done{false};
+    std::thread writer{[&rounds, &done] {
+      for (int round{1}; !done; ++round)
+        for (int key{0}; key < n_keys; ++key) rounds.set(key, round);
+    }};
+    for (int i{0}; i < 100; ++i) {
+      auto entries{rounds.snapshot()};
+      assert(entries.size() == n_keys);
+      for (int key{1}; key < n_keys; ++key)
+        assert(entries[key].second == entries[key - 1].second ||
+               entries[key].second == entries[key - 1].second - 1);
+      assert(entries.back().second + 1 >= entries.front().second);
+    }
+    done = true;
+    writer.join();
+  }
+  {
+    // a key read after every miss keeps its reference bit, so the hand passes
+    // it by, while the keys read once are evicted
+    threadsafe_cache<int, int> cache{64};
+    auto square = [](int key) { return key * key; };
+    assert(cache.get_or_compute(0, square) == 0);
+    for (int key{1}; key <= 10'000; ++key) {
+      assert(cache.get_or_compute(key, square) == key * key);
+      assert(cache.get_or_compute(0, square) == 0);
+    }
+    cache_stats stats{cache.stats()};
+    assert(stats.misses == 10'001 && stats.hits == 10'000);
+    assert(stats.misses - stats.evictions == 64);
+  }
+  {
+    // entries are evicted while other threads are still reading them
+    threadsafe_cache<int, std::string> cache{64};
+    std::vector<std::thread> threads;
+    for (int i_thread{0}; i_thread < 4; ++i_thread)
+      threads.emplace_back([&cache] {
+        std::default_random_engine engine{std::random_device{}()};
+        std::uniform_int_distribution<int> keys{0, 999};
+        for (int i{0}; i < 20'000; ++i) {
+          int key{keys(engine)};
+          assert(cache.get_or_compute(key, [](int key) {
+            return std::to_string(key);
+          }) == std::to_string(key));
+        }
+      });
+    for (auto &thread : threads) thread.join();
+    cache_stats stats{cache.stats()};
+    assert(stats.hits + stats.misses == 80'000);
+  }
+  {
+    // concurrent misses of one key collapse into one computation, whose
+    // exception reaches every caller, and a later call computes again
+    threadsafe_cache<int, int> cache{16};
+    std::atomic<int> n_computations{0};
+    auto slow_failure = [&n_computations](int) -> int {
+      ++n_computations;
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      throw std::runtime_error{"failed"};
+    };
+    std::atomic<int> n_failures{0};
+    std::vector<std::thread> threads;
+    for (int i{0}; i < 4; ++i)
+      threads.emplace_back([&] {
+        try {
+          cache.get_or_compute(1, slow_failure);
+        } catch (const std::runtime_error &) {
+          ++n_failures;
+        }
+      });
+    for (auto &thread : threads) thread.join();
+    assert(n_computations == 1 && n_failures == 4);
+    assert(cache.get_or_compute(1, [](int key) { return key; }) == 1);
+    assert(cache.stats().misses == 2);
+  }
+  {
+    bool rejected{false};
+    try {
+      threadsafe_lookup_table<int, int> invalid{16, {.max_load_factor = 1.5}};
+    } catch (const std::invalid_argument &) {
+      rejected = true;
+    }
+    assert(rejected);
+  }
+  {
+    threadsafe_lookup_table<int, int> batched{16};
+    std::vector<std::pair<int, int>> entries;
+    for (int key{0}; key < 1'000; ++key) entries.emplace_back(key, -key);
+    batched.multi_set(entries);
+    std::vector<int> keys;
+    for (int key{1'999}; key >= 0; --key) keys.push_back(key);
+    std::vector<std::optional<int>> out(keys.size(), 0);
+    assert(batched.multi_get(keys, out) == 1'000);
+    for (std::size_t i{0}; i < keys.size(); ++i)
+      assert(keys[i] < 1'000 ? out[i] == -keys[i] : !out[i]);
+    bool rejected{false};
+    try {
+      batched.multi_get(keys, std::span{out}.first(10));
+    } catch (const std::invalid_argument &) {
+      rejected = true;
+    }
+    assert(rejected);
+    // a key repeated far apart in one batch keeps its later value
+    for (int key{0}; key < 1'000; ++key) entries.emplace_back(key, key);
+    batched.multi_set(entries);
+    assert(batched.multi_get(keys, out) == 1'000);
+    for (std::size_t i{0}; i < keys.size(); ++i)
+      assert(keys[i] < 1'000 ? out[i] == keys[i] : !out[i]);
+  }
+  {
+    threadsafe_lookup_table<std::string, std::string> names{1};
+    for (int i{0}; i < 100; ++i)
+      names.set(std::to_string(i), "#" + std::to_string(i));
+    names.erase("7");
+    std::string name;
+    assert(names.try_get("42", name) && name == "#42");
+    assert(!names.try_get("7", name));
+    assert(names.snapshot().size() == 99);
+    const std::pair<std::string, std::string> renamed[]{{"7", "seven"},
+                                                       {"8", "eight"}};
+    names.multi_set(renamed);
+    const std::string keys[]{"6", "7", "8", "100"};
+    std::optional<std::string> out[std::size(keys)];
+    assert(names.multi_get(keys, out) == 3);
+    assert(out[0] == "#6" && out[1] == "seven" && out[2] == "eight" &&
+           !out[3]);
+  }
+
+  {
+    threadsafe_lookup_table<std::string, std::string, string_hash> words{16};
+    std::string_view hello{"hello"};
+    assert(words.try_emplace(hello, 3, 'a'));
+    assert(!words.try_emplace(std::string{"hello"}, "ignored"));
+    std::string word;
+    assert(words.try_get(hello, word) && word == "aaa");
+    assert(words.update(hello, [](std::string &value) { value += 'b'; }));
+    assert(!words.update(std::string_view{"bye"}, [](std::string &) {}));
+    std::size_t length{0};
+    assert(words.visit(hello, [&length](const std::string &value) {
+      length = value.size();
+    }));
+    assert(length == 4);
+    long long allocations_before{n_allocations};
+    assert(words.visit(hello, [](const std::string &value) {
+      assert(value == "aaab");
+    }));
+    assert(n_allocations == allocations_before);
+    words.erase(hello);
+    assert(!words.try_get(hello, word) && words.snapshot().empty());
+  }
+  {
+    threadsafe_lookup_table<int, int> counters{16};
+    assert(counters.try_emplace(1, 41));
+    assert(counters.update(1, [](int &value) { ++value; }));
+    int value{0};
+    assert(counters.visit(1, [&value](int v) { value = v; }) && value == 42);
+    assert(!counters.visit(2, [](int) { assert(false); }));
+  }
+
+  if constexpr (benchmark) {
+    const int n_records{1'000'000};
+    const int n_operations_per_thread{2'000'000};
+    report<list_lookup_table<int, int>>("list_buckets", n_records,
+                                        n_operations_per_thread);
+    report<threadsafe_lookup_table<int, int>>("open_addressing", n_records,
+                                              n_operations_per_thread);
+
+    const int n_growing_keys{10'000'000};
+    report_growth("incremental", {}, n_growing_keys);
+    report_growth("stop_the_shard",
+                  {.groups_per_step = std::numeric_limits<std::size_t>::max()},
+                  n_growing_keys);
+
+    const int n_snapshot_keys{1'000'000};
+    const int n_sets_per_writer{2'000'000};
+    report_snapshot_impact("no_snapshots", std::nullopt, n_snapshot_keys,
+                           n_sets_per_writer);
+    report_snapshot_impact("blocking", snapshot_mode::blocking,
+                           n_snapshot_keys, n_sets_per_writer);
+    report_snapshot_impact("copy_on_write", snapshot_mode::copy_on_write,
+                           n_snapshot_keys, n_sets_per_writer);
+
+    report_batches(n_records, n_operations_per_thread);
+
+    const int n_cacheable_keys{1'000'000};
+    for (double cached_fraction : {0.01, 0.1})
+      report_cache(cached_fraction, n_cacheable_keys, n_operations_per_thread);
+
+    report_string_lookups(100'000, n_operations_per_thread);
   }
 }
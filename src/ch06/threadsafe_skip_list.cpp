@@ -0,0 +1,735 @@
+//
+// Created by iphelf on 2026-10-17.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <latch>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <random>
+#include <shared_mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef BENCHMARK
+constexpr bool benchmark{true};
+#else
+constexpr bool benchmark{false};
+#endif
+
+// enough for 2^24 elements to get a level of their own
+constexpr int max_level{24};
+
+// every thread keeps a predecessor and a successor per level protected while
+// it searches and two more nodes while it scans a range, and every skip list
+// iterator claims two hazard pointers of its own. threads claim theirs all at
+// once, so the pool grows with the machine to fit four threads per hardware
+// thread
+constexpr std::size_t max_hazard_pointers_per_thread{2 * max_level + 2};
+constexpr std::size_t scan_hazard_pointer{2 * max_level};
+const std::size_t max_hazard_pointers{std::max<std::size_t>(
+    4096,
+    4 * max_hazard_pointers_per_thread * std::thread::hardware_concurrency())};
+
+struct hazard_pointer {
+  std::atomic<std::thread::id> owner{};
+  std::atomic<void *> pointer{nullptr};
+};
+// never resized, so the atomics stay put
+std::vector<hazard_pointer> hazard_pointers(max_hazard_pointers);
+
+class hazard_pointer_owner {
+  hazard_pointer *hp{nullptr};
+
+ public:
+  hazard_pointer_owner() {
+    for (auto &candidate : hazard_pointers) {
+      std::thread::id no_owner{};
+      if (candidate.owner.compare_exchange_strong(no_owner,
+                                                  std::this_thread::get_id())) {
+        hp = &candidate;
+        return;
+      }
+    }
+    throw std::runtime_error{"no hazard pointers available"};
+  }
+  hazard_pointer_owner(const hazard_pointer_owner &) = delete;
+  hazard_pointer_owner &operator=(const hazard_pointer_owner &) = delete;
+  ~hazard_pointer_owner() {
+    hp->pointer.store(nullptr);
+    hp->owner.store(std::thread::id{});
+  }
+  std::atomic<void *> &get_pointer() { return hp->pointer; }
+};
+
+std::atomic<void *> &get_hazard_pointer_for_current_thread(std::size_t i) {
+  thread_local hazard_pointer_owner owners[max_hazard_pointers_per_thread];
+  return owners[i].get_pointer();
+}
+
+struct retired_node {
+  void *pointer;
+  void (*deleter)(void *);
+};
+
+// nodes retired by threads that exited while the nodes were still hazardous
+struct orphanage {
+  std::mutex mutex;
+  std::vector<retired_node> nodes;
+  ~orphanage() {
+    for (auto &node : nodes) node.deleter(node.pointer);
+  }
+} orphaned_nodes;
+
+class retired_list {
+  std::vector<retired_node> nodes;
+
+ public:
+  retired_list() = default;
+  retired_list(const retired_list &) = delete;
+  retired_list &operator=(const retired_list &) = delete;
+  ~retired_list() {
+    scan();
+    if (nodes.empty()) return;
+    std::scoped_lock lock{orphaned_nodes.mutex};
+    orphaned_nodes.nodes.insert(orphaned_nodes.nodes.end(), nodes.begin(),
+                                nodes.end());
+  }
+  void retire(retired_node node) {
+    nodes.push_back(node);
+    if (nodes.size() >= 2 * max_hazard_pointers) scan();
+  }
+  void scan() {
+    {
+      std::scoped_lock lock{orphaned_nodes.mutex};
+      nodes.insert(nodes.end(), orphaned_nodes.nodes.begin(),
+                   orphaned_nodes.nodes.end());
+      orphaned_nodes.nodes.clear();
+    }
+    std::vector<void *> hazards;
+    for (auto &hp : hazard_pointers)
+      if (void *p{hp.pointer.load()}) hazards.push_back(p);
+    std::sort(hazards.begin(), hazards.end());
+    std::erase_if(nodes, [&hazards](const retired_node &node) {
+      if (std::binary_search(hazards.begin(), hazards.end(), node.pointer))
+        return false;
+      node.deleter(node.pointer);
+      return true;
+    });
+  }
+};
+
+void retire(retired_node node) {
+  thread_local retired_list retired;
+  retired.retire(node);
+}
+
+/// lazy skip list (Herlihy, Lev, Luchangco and Shavit): searches take no
+/// locks, while insert and erase lock only the predecessors they relink and
+/// validate them first. A node is logically erased by marking it, which also
+/// freezes its links, and is then unlinked level by level and reclaimed
+/// through hazard pointers
+template <typename Key, typename Value, typename Compare = std::less<Key>>
+class threadsafe_skip_list {
+  struct node;
+  struct node_base {
+    std::mutex mutex;
+    std::atomic<bool> marked{false};
+    std::atomic<bool> fully_linked{false};
+    const int height;
+    std::atomic<node *> *const next;
+    node_base(int height, std::atomic<node *> *next)
+        : height{height}, next{next} {}
+  };
+  // the links of a node are allocated right behind it
+  struct node : node_base {
+    const Key key;
+    const Value value;
+    node(int height, const Key &key, const Value &value)
+        : node_base{height, reinterpret_cast<std::atomic<node *> *>(this + 1)},
+          key{key},
+          value{value} {}
+    static node *create(int height, const Key &key, const Value &value) {
+      void *raw{::operator new(sizeof(node) +
+                               height * sizeof(std::atomic<node *>))};
+      auto *links{reinterpret_cast<std::atomic<node *> *>(
+          static_cast<std::byte *>(raw) + sizeof(node))};
+      for (int level{0}; level < height; ++level)
+        new (links + level) std::atomic<node *>{nullptr};
+      return new (raw) node{height, key, value};
+    }
+    static void destroy(void *pointer) {
+      static_cast<node *>(pointer)->~node();
+      ::operator delete(pointer);
+    }
+  };
+
+  std::atomic<node *> head_links[max_level]{};
+  // dummy head, which is never marked
+  mutable node_base head{max_level, head_links};
+  // the levels any node has ever been linked at, where searches start
+  std::atomic<int> n_levels{1};
+  Compare compare{};
+
+  static bool live(const node *n) {
+    return n->fully_linked.load() && !n->marked.load();
+  }
+
+  static int random_height() {
+    thread_local std::default_random_engine engine{std::random_device{}()};
+    thread_local std::uniform_int_distribution<std::uint32_t> distribution;
+    return std::min(max_level, std::countr_one(distribution(engine)) + 1);
+  }
+
+  /// fills preds and succs with the last node before key and the first one
+  /// from key on at every level in use, leaving both protected by the thread's
+  /// hazard pointers, and returns the highest level key was found at, or -1.
+  /// A search restarts from the top when a predecessor gets marked under it,
+  /// since the links of a marked node may lead to reclaimed nodes
+  int find_preds(const Key &key, node_base *preds[max_level],
+                 node *succs[max_level]) const {
+    for (;;) {
+      int found{-1};
+      node_base *pred{&head};
+      bool restart{false};
+      for (int level{n_levels.load() - 1}; level >= 0 && !restart; --level) {
+        // pred is still protected by the level above, and every step swaps
+        // the two hazard pointers of the level instead of copying curr over
+        std::atomic<void *> *hp_pred{
+            &get_hazard_pointer_for_current_thread(2 * level)};
+        std::atomic<void *> *hp_succ{
+            &get_hazard_pointer_for_current_thread(2 * level + 1)};
+        node *curr{pred->next[level].load()};
+        for (;;) {
+          hp_succ->store(curr);
+          if (node *current{pred->next[level].load()}; current != curr) {
+            curr = current;
+            continue;
+          }
+          if (pred->marked.load()) {
+            restart = true;
+            break;
+          }
+          if (!curr || !compare(curr->key, key)) break;
+          pred = curr;
+          std::swap(hp_pred, hp_succ);
+          curr = pred->next[level].load();
+        }
+        if (found == -1 && curr && !compare(key, curr->key)) found = level;
+        preds[level] = pred;
+        succs[level] = curr;
+      }
+      if (!restart) return found;
+    }
+  }
+
+  /// moves from n, protected by hp, to the next live node, keeping that
+  /// protected by hp in turn; next_hp protects the successor while it is being
+  /// validated
+  node *next_live(node *n, std::atomic<void *> &hp,
+                  std::atomic<void *> &next_hp) const {
+    while (n) {
+      node *next{n->next[0].load()};
+      next_hp.store(next);
+      if (n->next[0].load() != next) continue;
+      if (n->marked.load()) {
+        // n may have been unlinked, so its successor is looked up anew
+        node_base *preds[max_level];
+        node *succs[max_level];
+        find_preds(n->key, preds, succs);
+        next = succs[0];
+        next_hp.store(next);
+        if (next && !compare(n->key, next->key)) {
+          // a node with the key just visited, inserted after n was erased
+          hp.store(next);
+          n = next;
+          continue;
+        }
+      }
+      hp.store(next);
+      n = next;
+      if (n && live(n)) break;
+    }
+    next_hp.store(nullptr);
+    return n;
+  }
+
+ public:
+  /// input iterator over the live nodes in key order, which stays safe to use
+  /// while other threads insert and erase, erasing its node included
+  class iterator {
+    const threadsafe_skip_list *list{nullptr};
+    std::unique_ptr<hazard_pointer_owner> hp{nullptr};
+    std::unique_ptr<hazard_pointer_owner> next_hp{nullptr};
+    node *current{nullptr};
+
+    friend class threadsafe_skip_list;
+    explicit iterator(const threadsafe_skip_list *list)
+        : list{list},
+          hp{std::make_unique<hazard_pointer_owner>()},
+          next_hp{std::make_unique<hazard_pointer_owner>()} {}
+
+   public:
+    using value_type = std::pair<const Key &, const Value &>;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+    value_type operator*() const { return {current->key, current->value}; }
+    iterator &operator++() {
+      current = list->next_live(current, hp->get_pointer(),
+                                next_hp->get_pointer());
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+    friend bool operator==(const iterator &it, std::default_sentinel_t) {
+      return !it.current;
+    }
+  };
+
+  threadsafe_skip_list() = default;
+  threadsafe_skip_list(const threadsafe_skip_list &) = delete;
+  threadsafe_skip_list &operator=(const threadsafe_skip_list &) = delete;
+  ~threadsafe_skip_list() {
+    for (node *n{head.next[0].load()}; n;) {
+      node *next{n->next[0].load()};
+      node::destroy(n);
+      n = next;
+    }
+  }
+
+  /// returns false, leaving the list as it is, if key is already there
+  bool insert(const Key &key, const Value &value) {
+    int height{random_height()};
+    for (int levels{n_levels.load()};
+         levels < height && !n_levels.compare_exchange_weak(levels, height);) {
+    }
+    node_base *preds[max_level];
+    node *succs[max_level];
+    for (;;) {
+      if (int found{find_preds(key, preds, succs)}; found != -1) {
+        node *existing{succs[found]};
+        if (existing->marked.load()) continue;
+        while (!existing->fully_linked.load()) std::this_thread::yield();
+        return false;
+      }
+      // predecessors are locked bottom up, so in decreasing key order
+      std::unique_lock<std::mutex> locks[max_level];
+      bool valid{true};
+      for (int level{0}; valid && level < height; ++level) {
+        node_base *pred{preds[level]};
+        node *succ{succs[level]};
+        if (level == 0 || pred != preds[level - 1])
+          locks[level] = std::unique_lock{pred->mutex};
+        valid = !pred->marked.load() && (!succ || !succ->marked.load()) &&
+                pred->next[level].load() == succ;
+      }
+      if (!valid) continue;
+      node *new_node{node::create(height, key, value)};
+      for (int level{0}; level < height; ++level)
+        new_node->next[level].store(succs[level]);
+      for (int level{0}; level < height; ++level)
+        preds[level]->next[level].store(new_node);
+      new_node->fully_linked.store(true);
+      return true;
+    }
+  }
+
+  /// returns false if key is not there
+  bool erase(const Key &key) {
+    node_base *preds[max_level];
+    node *succs[max_level];
+    node *victim{nullptr};
+    std::unique_lock<std::mutex> victim_lock;
+    for (;;) {
+      int found{find_preds(key, preds, succs)};
+      if (!victim) {
+        if (found == -1) return false;
+        node *candidate{succs[found]};
+        // not yet inserted, or already being erased
+        if (!live(candidate)) return false;
+        // its insertion raised n_levels after the search had started
+        if (candidate->height - 1 != found) continue;
+        victim_lock = std::unique_lock{candidate->mutex};
+        if (candidate->marked.load()) return false;
+        // only the thread marking a node unlinks and retires it, so the
+        // victim stays allocated even when a retry moves the hazard pointers
+        candidate->marked.store(true);
+        victim = candidate;
+      }
+      std::unique_lock<std::mutex> locks[max_level];
+      bool valid{true};
+      for (int level{0}; valid && level < victim->height; ++level) {
+        node_base *pred{preds[level]};
+        if (level == 0 || pred != preds[level - 1])
+          locks[level] = std::unique_lock{pred->mutex};
+        valid = !pred->marked.load() && pred->next[level].load() == victim;
+      }
+      if (!valid) continue;
+      for (int level{victim->height - 1}; level >= 0; --level)
+        preds[level]->next[level].store(victim->next[level].load());
+      victim_lock.unlock();
+      for (auto &lock : locks)
+        if (lock) lock.unlock();
+      retire({victim, node::destroy});
+      return true;
+    }
+  }
+
+  std::optional<Value> find(const Key &key) const {
+    node_base *preds[max_level];
+    node *succs[max_level];
+    int found{find_preds(key, preds, succs)};
+    if (found == -1 || !live(succs[found])) return std::nullopt;
+    return succs[found]->value;
+  }
+
+  bool contains(const Key &key) const { return find(key).has_value(); }
+
+  /// the first live node whose key is not less than key
+  iterator lower_bound(const Key &key) const {
+    iterator it{this};
+    node_base *preds[max_level];
+    node *succs[max_level];
+    find_preds(key, preds, succs);
+    it.current = succs[0];
+    it.hp->get_pointer().store(it.current);
+    if (it.current && !live(it.current))
+      it.current = next_live(it.current, it.hp->get_pointer(),
+                             it.next_hp->get_pointer());
+    return it;
+  }
+
+  iterator begin() const {
+    iterator it{this};
+    std::atomic<void *> &hp{it.hp->get_pointer()};
+    node *first{head.next[0].load()};
+    for (;;) {
+      hp.store(first);
+      if (node *current{head.next[0].load()}; current != first)
+        first = current;
+      else
+        break;
+    }
+    it.current = first;
+    if (first && !live(first))
+      it.current = next_live(first, hp, it.next_hp->get_pointer());
+    return it;
+  }
+
+  std::default_sentinel_t end() const { return {}; }
+
+  /// visits the keys in [low, high) in order
+  template <typename Visit>
+  void for_each_in_range(const Key &low, const Key &high, Visit visit) const {
+    // the thread's own hazard pointers spare claiming those of an iterator
+    std::atomic<void *> &hp{
+        get_hazard_pointer_for_current_thread(scan_hazard_pointer)};
+    std::atomic<void *> &next_hp{
+        get_hazard_pointer_for_current_thread(scan_hazard_pointer + 1)};
+    node_base *preds[max_level];
+    node *succs[max_level];
+    find_preds(low, preds, succs);
+    node *n{succs[0]};
+    hp.store(n);
+    if (n && !live(n)) n = next_live(n, hp, next_hp);
+    for (; n && compare(n->key, high); n = next_live(n, hp, next_hp))
+      visit(n->key, n->value);
+    hp.store(nullptr);
+  }
+
+  bool empty() const { return begin() == end(); }
+};
+
+/// the hand-over-hand list of threadsafe_forward_list.cpp, as the baseline
+template <typename T>
+class threadsafe_forward_list {
+  struct Node {
+    std::shared_ptr<T> data{nullptr};
+    std::unique_ptr<Node> next{nullptr};
+    std::mutex mutex;
+  };
+  // dummy head
+  std::unique_ptr<Node> head{std::make_unique<Node>()};
+
+ public:
+  void push_front(const T &item) {
+    std::unique_ptr<Node> new_node{std::make_unique<Node>()};
+    new_node->data = std::make_shared<T>(item);
+    std::scoped_lock lock{head->mutex};
+    new_node->next = std::move(head->next);
+    head->next = std::move(new_node);
+  }
+
+  template <typename Visit>
+  void for_each(Visit visit) {
+    std::unique_lock last_lock{head->mutex};
+    Node *last_node{head.get()};
+    while (Node * node{last_node->next.get()}) {
+      std::unique_lock lock{node->mutex};
+      last_lock.unlock();
+      visit(*node->data);
+      last_node = node;
+      last_lock = std::move(lock);
+    }
+  }
+
+  template <typename Predicate>
+  std::shared_ptr<T> find_first_if(Predicate predicate) {
+    std::unique_lock last_lock{head->mutex};
+    Node *last_node{head.get()};
+    while (Node * node{last_node->next.get()}) {
+      std::unique_lock lock{node->mutex};
+      last_lock.unlock();
+      if (predicate(*node->data)) return node->data;
+      last_node = node;
+      last_lock = std::move(lock);
+    }
+    return nullptr;
+  }
+
+  template <typename Predicate>
+  void remove_if(Predicate predicate) {
+    std::unique_lock last_lock{head->mutex};
+    Node *last_node{head.get()};
+    while (Node * node{last_node->next.get()}) {
+      std::unique_lock lock{node->mutex};
+      if (predicate(*node->data)) {
+        std::unique_ptr<Node> deleting_node{std::move(last_node->next)};
+        last_node->next = std::move(node->next);
+        lock.unlock();
+      } else {
+        last_lock.unlock();
+        last_node = node;
+        last_lock = std::move(lock);
+      }
+    }
+  }
+};
+
+/// the sorted map operations of the benchmark on top of the forward list;
+/// insert is not atomic with the lookup before it, which only matters to the
+/// benchmark as a few duplicates
+template <typename Key, typename Value>
+class forward_list_map {
+  threadsafe_forward_list<std::pair<Key, Value>> list;
+
+ public:
+  bool insert(const Key &key, const Value &value) {
+    if (find(key)) return false;
+    list.push_front({key, value});
+    return true;
+  }
+  bool erase(const Key &key) {
+    bool erased{false};
+    list.remove_if([&](const auto &item) {
+      if (item.first != key) return false;
+      erased = true;
+      return true;
+    });
+    return erased;
+  }
+  std::optional<Value> find(const Key &key) {
+    auto found{list.find_first_if(
+        [&key](const auto &item) { return item.first == key; })};
+    if (!found) return std::nullopt;
+    return found->second;
+  }
+  template <typename Visit>
+  void for_each_in_range(const Key &low, const Key &high, Visit visit) {
+    std::vector<std::pair<Key, Value>> in_range;
+    list.for_each([&](const auto &item) {
+      if (!(item.first < low) && item.first < high) in_range.push_back(item);
+    });
+    std::sort(in_range.begin(), in_range.end());
+    for (auto &[key, value] : in_range) visit(key, value);
+  }
+};
+
+template <typename Key, typename Value>
+class shared_mutex_map {
+  mutable std::shared_mutex mutex;
+  std::map<Key, Value> map;
+
+ public:
+  bool insert(const Key &key, const Value &value) {
+    std::unique_lock lock{mutex};
+    return map.emplace(key, value).second;
+  }
+  bool erase(const Key &key) {
+    std::unique_lock lock{mutex};
+    return map.erase(key) > 0;
+  }
+  std::optional<Value> find(const Key &key) const {
+    std::shared_lock lock{mutex};
+    auto it{map.find(key)};
+    if (it == map.end()) return std::nullopt;
+    return it->second;
+  }
+  template <typename Visit>
+  void for_each_in_range(const Key &low, const Key &high, Visit visit) const {
+    std::shared_lock lock{mutex};
+    for (auto it{map.lower_bound(low)}; it != map.end() && it->first < high;
+         ++it)
+      visit(it->first, it->second);
+  }
+};
+
+/// threads pick random keys out of twice the initial size and look them up,
+/// insert or erase them (8:1:1), or scan the 100 keys from them on, for a
+/// second
+template <typename Map>
+void report(const char *name, int n_keys, bool scans) {
+  Map map;
+  std::vector<int> keys(n_keys);
+  for (int i{0}; i < n_keys; ++i) keys[i] = 2 * i;
+  std::shuffle(keys.begin(), keys.end(),
+               std::default_random_engine{std::random_device{}()});
+  for (int key : keys) map.insert(key, key);
+  const int n_threads{
+      std::max(1, static_cast<int>(std::thread::hardware_concurrency()))};
+  std::atomic<bool> done{false};
+  std::atomic<long long> n_operations{0};
+  std::latch latch{n_threads + 1};
+  std::vector<std::thread> threads;
+  for (int i_thread{0}; i_thread < n_threads; ++i_thread)
+    threads.emplace_back([&] {
+      std::default_random_engine engine{std::random_device{}()};
+      std::uniform_int_distribution<int> random_key{0, 2 * n_keys - 1};
+      std::uniform_int_distribution<int> random_operation{0, 9};
+      long long n{0};
+      latch.arrive_and_wait();
+      for (; !done.load(std::memory_order_relaxed); ++n) {
+        int key{random_key(engine)};
+        if (scans) {
+          long long sum{0};
+          map.for_each_in_range(key, key + 100,
+                                [&sum](int, int value) { sum += value; });
+          assert(sum >= 0);
+        } else if (int operation{random_operation(engine)}; operation == 0) {
+          map.insert(key, key);
+        } else if (operation == 1) {
+          map.erase(key);
+        } else if (auto value{map.find(key)}) {
+          assert(*value == key);
+        }
+      }
+      n_operations += n;
+    });
+  latch.arrive_and_wait();
+  auto start_time{std::chrono::steady_clock::now()};
+  std::this_thread::sleep_for(std::chrono::seconds{1});
+  done = true;
+  for (auto &thread : threads) thread.join();
+  auto elapsed{std::chrono::steady_clock::now() - start_time};
+  std::cout << name << '\t' << n_keys << " keys\t" << n_threads
+            << " threads\t" << (scans ? "scan\t" : "find/insert/erase\t")
+            << n_operations / std::chrono::duration<double>(elapsed).count()
+            << " ops/s\n";
+}
+
+int main() {
+  {
+    threadsafe_skip_list<int, int> list;
+    assert(list.empty());
+    const int n{1'000};
+    std::vector<int> keys(n);
+    for (int i{0}; i < n; ++i) keys[i] = i;
+    std::shuffle(keys.begin(), keys.end(), std::default_random_engine{});
+    for (int key : keys) assert(list.insert(key, -key));
+    assert(!list.insert(0, 1));
+    for (int key{0}; key < n; ++key) assert(list.find(key) == -key);
+    assert(!list.find(n));
+    {
+      int expected{0};
+      for (auto [key, value] : list) {
+        assert(key == expected && value == -expected);
+        ++expected;
+      }
+      assert(expected == n);
+    }
+    for (int key{0}; key < n; key += 2) assert(list.erase(key));
+    assert(!list.erase(0));
+    {
+      std::vector<int> in_range;
+      list.for_each_in_range(10, 20, [&in_range](int key, int) {
+        in_range.push_back(key);
+      });
+      assert((in_range == std::vector{11, 13, 15, 17, 19}));
+    }
+    {
+      // an iterator whose node gets erased carries on after its key
+      auto it{list.lower_bound(100)};
+      assert((*it).first == 101);
+      assert(list.erase(101) && list.erase(103));
+      ++it;
+      assert((*it).first == 105);
+    }
+    for (int key{1}; key < n; key += 2) list.erase(key);
+    assert(list.empty());
+  }
+
+  {
+    // threads insert and erase their own keys while others scan them all
+    const int n_threads{
+        std::max(2, static_cast<int>(std::thread::hardware_concurrency()))};
+    const int n_keys_per_thread{10'000};
+    threadsafe_skip_list<int, int> list;
+    std::atomic<int> n_writers_left{n_threads};
+    std::latch latch{2 * n_threads};
+    std::vector<std::thread> threads;
+    for (int i_thread{0}; i_thread < n_threads; ++i_thread) {
+      threads.emplace_back([&, i_thread] {
+        latch.arrive_and_wait();
+        for (int i{0}; i < n_keys_per_thread; ++i) {
+          int key{i * n_threads + i_thread};
+          assert(list.insert(key, key));
+          assert(list.find(key) == key);
+          if (i % 2 == 0) assert(list.erase(key));
+        }
+        --n_writers_left;
+      });
+      threads.emplace_back([&] {
+        latch.arrive_and_wait();
+        while (n_writers_left > 0) {
+          int last_key{-1};
+          for (auto [key, value] : list) {
+            assert(key > last_key && value == key);
+            last_key = key;
+          }
+        }
+      });
+    }
+    for (auto &thread : threads) thread.join();
+    int n_left{0};
+    for (auto [key, value] : list) {
+      assert((key / n_threads) % 2 == 1);
+      ++n_left;
+    }
+    assert(n_left == n_threads * n_keys_per_thread / 2);
+  }
+
+  if constexpr (benchmark) {
+    for (int n_keys : {1'000, 10'000, 100'000, 1'000'000, 10'000'000})
+      for (bool scans : {false, true}) {
+        // every operation on the forward list walks it
+        if (n_keys <= 10'000)
+          report<forward_list_map<int, int>>("forward_list", n_keys, scans);
+        report<shared_mutex_map<int, int>>("shared_mutex_map", n_keys, scans);
+        report<threadsafe_skip_list<int, int>>("skip_list", n_keys, scans);
+      }
+  }
+}